@@ -1,12 +1,24 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-frame camera data, shared by all programs (see CameraUniforms.h)
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPos;
+    float time;
+};
+
+// per-draw transform, a range of the frame's ring buffer bound by the render queue
+layout (std140) uniform Transforms
+{
+    mat4 model;
+};
 
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
+	gl_Position = viewProjection * model * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,194 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+// Counts heap allocations made through operator new, to measure how allocation heavy a piece of code is.
+// Replacing the global operator new/delete is a diagnostics tool, not something a normal build should carry: the
+// counting versions are only compiled in builds that define ALLOCATION_STATS (off by default, the AllocationStats|x64
+// configuration is Debug with it defined), and there only in the one translation unit that defines
+// ALLOCATION_COUNTER_IMPLEMENTATION before including this file. Otherwise the counters simply stay at zero.
+
+#ifdef ALLOCATION_STATS
+const bool ALLOCATION_COUNTING = true;
+#else
+const bool ALLOCATION_COUNTING = false;
+#endif
+
+// number of allocations so far
+inline atomic<size_t>& AllocationCount()
+{
+    static atomic<size_t> count(0);
+    return count;
+}
+
+// bytes requested by those allocations
+inline atomic<size_t>& AllocatedBytes()
+{
+    static atomic<size_t> bytes(0);
+    return bytes;
+}
+
+// ", N heap allocations" since a count taken earlier, for log lines. Empty when allocations are not counted.
+inline string AllocationSummary(size_t countBefore)
+{
+    if (!ALLOCATION_COUNTING)
+        return string();
+    return ", " + to_string(AllocationCount() - countBefore) + " heap allocations";
+}
+
+#if defined(ALLOCATION_STATS) && defined(ALLOCATION_COUNTER_IMPLEMENTATION)
+#include <cstdlib>
+#include <new>
+
+// every replaceable form is replaced, so no allocation made here is ever released by the default allocator or the
+// other way round. They are kept out of line: inlined into a new/delete pair, GCC would see malloc matched with a
+// plain delete and warn (-Wmismatched-new-delete).
+#ifdef _MSC_VER
+#define ALLOCATION_COUNTER_NOINLINE __declspec(noinline)
+#else
+#define ALLOCATION_COUNTER_NOINLINE __attribute__((noinline))
+#endif
+
+inline void* countedAllocate(size_t size)
+{
+    AllocationCount()++;
+    AllocatedBytes() += size;
+    return malloc(size > 0 ? size : 1);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new(size_t size)
+{
+    if (void* memory = countedAllocate(size))
+        return memory;
+    throw bad_alloc();
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    return countedAllocate(size);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    return countedAllocate(size);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* memory) noexcept
+{
+    free(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* memory, const nothrow_t&) noexcept
+{
+    free(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* memory, const nothrow_t&) noexcept
+{
+    free(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+#ifdef __cpp_aligned_new
+// over-aligned types, C++17 on. Windows has no aligned free() of its own kind, it pairs _aligned_malloc with _aligned_free.
+inline void* countedAllocateAligned(size_t size, align_val_t alignment)
+{
+    AllocationCount()++;
+    AllocatedBytes() += size;
+    size_t bytes = size > 0 ? size : 1;
+#ifdef _WIN32
+    return _aligned_malloc(bytes, static_cast<size_t>(alignment));
+#else
+    void* memory = nullptr;
+    size_t minimum = static_cast<size_t>(alignment) < sizeof(void*) ? sizeof(void*) : static_cast<size_t>(alignment);
+    return posix_memalign(&memory, minimum, bytes) == 0 ? memory : nullptr;
+#endif
+}
+
+inline void freeAligned(void* memory)
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new(size_t size, align_val_t alignment)
+{
+    if (void* memory = countedAllocateAligned(size, alignment))
+        return memory;
+    throw bad_alloc();
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](size_t size, align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return countedAllocateAligned(size, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return countedAllocateAligned(size, alignment);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* memory, align_val_t) noexcept
+{
+    freeAligned(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* memory, align_val_t) noexcept
+{
+    freeAligned(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* memory, align_val_t, const nothrow_t&) noexcept
+{
+    freeAligned(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* memory, align_val_t, const nothrow_t&) noexcept
+{
+    freeAligned(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete(void* memory, size_t, align_val_t) noexcept
+{
+    freeAligned(memory);
+}
+
+ALLOCATION_COUNTER_NOINLINE void operator delete[](void* memory, size_t, align_val_t) noexcept
+{
+    freeAligned(memory);
+}
+#endif
+#endif
+#endif
@@ -0,0 +1,331 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm/glm.hpp>
+
+#include "Bounds.h"
+#include "Frustum.h"
+#include "Ray.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// a node is a box plus either its two children (count == 0, they are stored next to each other at leftFirst) or a
+// range of primitives (count > 0, starting at leftFirst in the BVH's primitive order). 32 bytes, two per cache line.
+struct BVHNode {
+    glm::vec3 min;
+    uint32_t  leftFirst;
+    glm::vec3 max;
+    uint32_t  count;
+};
+static_assert(sizeof(BVHNode) == 32, "BVHNode should stay 32 bytes");
+
+// the nearest thing a ray hit
+struct RayHit {
+    uint32_t primitive;
+    float    distance;
+};
+
+// primitives below which a node is never split
+const uint32_t BVH_MAX_LEAF_SIZE = 2;
+// candidate split planes per axis of the binned SAH build
+const int BVH_BINS = 16;
+// deeper nodes stay leaves, which bounds the traversal stacks
+const int BVH_MAX_DEPTH = 48;
+
+// Bounding volume hierarchy over world space bounds, one primitive per Bounds (a mesh, a model instance...) and
+// identified by its index in the vector it was built from. Built top down with a binned surface area heuristic;
+// when the primitives move, Refit() updates the boxes without changing the tree, which stays good as long as the
+// scene does not change too much (Build() again otherwise). Pure CPU code, no GL.
+class BVH
+{
+public:
+    void Build(const vector<Bounds>& primitives)
+    {
+        bounds = primitives;
+        order.resize(primitives.size());
+        for (uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        nodes.clear();
+        if (primitives.empty())
+            return;
+        nodes.reserve(primitives.size() * 2);
+        BVHNode root;
+        root.leftFirst = 0;
+        root.count = static_cast<uint32_t>(primitives.size());
+        nodes.push_back(root);
+        updateNodeBox(0);
+        subdivide(0, 0);
+    }
+
+    // updates every box bottom up for primitives that moved, the vector must hold the same primitives as at Build()
+    void Refit(const vector<Bounds>& primitives)
+    {
+        if (primitives.size() != bounds.size())
+        {
+            Build(primitives);
+            return;
+        }
+        bounds = primitives;
+        // children are always created after their parent, so walking backwards visits them first
+        for (size_t i = nodes.size(); i-- > 0;)
+        {
+            BVHNode& node = nodes[i];
+            if (node.count > 0)
+            {
+                updateNodeBox(static_cast<uint32_t>(i));
+                continue;
+            }
+            const BVHNode& left = nodes[node.leftFirst];
+            const BVHNode& right = nodes[node.leftFirst + 1];
+            node.min = glm::min(left.min, right.min);
+            node.max = glm::max(left.max, right.max);
+        }
+    }
+
+    // appends every primitive intersecting the frustum. Subtrees entirely inside are taken without further tests.
+    void Query(const Frustum& frustum, vector<uint32_t>& visible) const
+    {
+        if (nodes.empty())
+            return;
+        uint32_t stack[BVH_MAX_DEPTH + 2];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            const BVHNode& node = nodes[stack[--stackSize]];
+            if (!frustum.IntersectsBox(node.min, node.max))
+                continue;
+            if (frustum.ContainsBox(node.min, node.max))
+            {
+                appendSubtree(node, visible);
+                continue;
+            }
+            if (node.count > 0)
+            {
+                for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+                {
+                    if (frustum.Intersects(bounds[order[i]]))
+                        visible.push_back(order[i]);
+                }
+                continue;
+            }
+            stack[stackSize++] = node.leftFirst;
+            stack[stackSize++] = node.leftFirst + 1;
+        }
+    }
+
+    // nearest primitive box the ray enters within maxDistance
+    bool Raycast(const Ray& ray, float maxDistance, RayHit& hit) const
+    {
+        return Raycast(ray, maxDistance, hit, [](uint32_t, const Ray&, float, float&) { return true; });
+    }
+
+    // nearest hit within maxDistance, with intersect(primitive, ray, maxDistance, distance) deciding whether and where
+    // the ray hits a primitive whose box it enters (e.g. against its triangles); distance is preset to the box entry.
+    // Children are visited near to far and skipped once a closer hit is known.
+    template <typename IntersectPrimitive>
+    bool Raycast(const Ray& ray, float maxDistance, RayHit& hit, IntersectPrimitive intersect) const
+    {
+        if (nodes.empty())
+            return false;
+        glm::vec3 inverseDirection = InverseDirection(ray.direction);
+        float nearest = maxDistance;
+        bool found = false;
+        float entry;
+        if (!IntersectRayBox(ray, inverseDirection, nodes[0].min, nodes[0].max, nearest, entry))
+            return false;
+
+        struct StackEntry {
+            uint32_t node;
+            float entry;
+        };
+        StackEntry stack[BVH_MAX_DEPTH + 2];
+        int stackSize = 0;
+        stack[stackSize++] = { 0, entry };
+        while (stackSize > 0)
+        {
+            StackEntry current = stack[--stackSize];
+            if (current.entry > nearest)
+                continue;
+            const BVHNode& node = nodes[current.node];
+            if (node.count > 0)
+            {
+                for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+                {
+                    const Bounds& primitive = bounds[order[i]];
+                    float distance;
+                    if (!IntersectRayBox(ray, inverseDirection, primitive.min, primitive.max, nearest, distance))
+                        continue;
+                    if (intersect(order[i], ray, nearest, distance) && distance <= nearest)
+                    {
+                        nearest = distance;
+                        hit.primitive = order[i];
+                        hit.distance = distance;
+                        found = true;
+                    }
+                }
+                continue;
+            }
+            float leftEntry, rightEntry;
+            bool hitLeft = IntersectRayBox(ray, inverseDirection, nodes[node.leftFirst].min, nodes[node.leftFirst].max, nearest, leftEntry);
+            bool hitRight = IntersectRayBox(ray, inverseDirection, nodes[node.leftFirst + 1].min, nodes[node.leftFirst + 1].max, nearest, rightEntry);
+            // the nearer child goes on top of the stack
+            if (hitLeft && hitRight && leftEntry < rightEntry)
+            {
+                stack[stackSize++] = { node.leftFirst + 1, rightEntry };
+                stack[stackSize++] = { node.leftFirst, leftEntry };
+            }
+            else
+            {
+                if (hitLeft)
+                    stack[stackSize++] = { node.leftFirst, leftEntry };
+                if (hitRight)
+                    stack[stackSize++] = { node.leftFirst + 1, rightEntry };
+            }
+        }
+        return found;
+    }
+
+    size_t NodeCount() const { return nodes.size(); }
+    size_t PrimitiveCount() const { return bounds.size(); }
+
+private:
+    vector<BVHNode> nodes;
+    vector<Bounds> bounds;  // per primitive, by primitive index
+    vector<uint32_t> order; // primitive indices, each leaf covers a consecutive range
+
+    struct Bin {
+        glm::vec3 min = glm::vec3(FLT_MAX);
+        glm::vec3 max = glm::vec3(-FLT_MAX);
+        uint32_t count = 0;
+    };
+
+    static float area(const glm::vec3& min, const glm::vec3& max)
+    {
+        glm::vec3 extent = max - min;
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    static glm::vec3 centroid(const Bounds& primitive)
+    {
+        return (primitive.min + primitive.max) * 0.5f;
+    }
+
+    void updateNodeBox(uint32_t index)
+    {
+        BVHNode& node = nodes[index];
+        node.min = glm::vec3(FLT_MAX);
+        node.max = glm::vec3(-FLT_MAX);
+        for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+        {
+            node.min = glm::min(node.min, bounds[order[i]].min);
+            node.max = glm::max(node.max, bounds[order[i]].max);
+        }
+    }
+
+    void appendSubtree(const BVHNode& node, vector<uint32_t>& visible) const
+    {
+        if (node.count > 0)
+        {
+            visible.insert(visible.end(), order.begin() + node.leftFirst, order.begin() + node.leftFirst + node.count);
+            return;
+        }
+        appendSubtree(nodes[node.leftFirst], visible);
+        appendSubtree(nodes[node.leftFirst + 1], visible);
+    }
+
+    // splits the node where the surface area heuristic says a split pays off, then recurses into the halves
+    void subdivide(uint32_t index, int depth)
+    {
+        uint32_t first = nodes[index].leftFirst, count = nodes[index].count;
+        if (count <= BVH_MAX_LEAF_SIZE || depth >= BVH_MAX_DEPTH)
+            return;
+
+        glm::vec3 centroidMin = glm::vec3(FLT_MAX), centroidMax = glm::vec3(-FLT_MAX);
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            centroidMin = glm::min(centroidMin, centroid(bounds[order[i]]));
+            centroidMax = glm::max(centroidMax, centroid(bounds[order[i]]));
+        }
+
+        // cost of a split: primitives times box area on each side, against all primitives in the node's box
+        float bestCost = count * area(nodes[index].min, nodes[index].max);
+        int bestAxis = -1;
+        float bestPosition = 0.0f;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f)
+                continue;
+            Bin bins[BVH_BINS];
+            float scale = BVH_BINS / extent;
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                const Bounds& primitive = bounds[order[i]];
+                int bin = std::min(BVH_BINS - 1, static_cast<int>((centroid(primitive)[axis] - centroidMin[axis]) * scale));
+                bins[bin].count++;
+                bins[bin].min = glm::min(bins[bin].min, primitive.min);
+                bins[bin].max = glm::max(bins[bin].max, primitive.max);
+            }
+            // sweep from both sides so every plane between two bins is evaluated in linear time
+            float leftArea[BVH_BINS - 1], rightArea[BVH_BINS - 1];
+            uint32_t leftCount[BVH_BINS - 1], rightCount[BVH_BINS - 1];
+            Bin left, right;
+            for (int i = 0; i < BVH_BINS - 1; i++)
+            {
+                left.count += bins[i].count;
+                left.min = glm::min(left.min, bins[i].min);
+                left.max = glm::max(left.max, bins[i].max);
+                leftCount[i] = left.count;
+                leftArea[i] = left.count > 0 ? area(left.min, left.max) : 0.0f;
+                const Bin& rightBin = bins[BVH_BINS - 1 - i];
+                right.count += rightBin.count;
+                right.min = glm::min(right.min, rightBin.min);
+                right.max = glm::max(right.max, rightBin.max);
+                rightCount[BVH_BINS - 2 - i] = right.count;
+                rightArea[BVH_BINS - 2 - i] = right.count > 0 ? area(right.min, right.max) : 0.0f;
+            }
+            for (int i = 0; i < BVH_BINS - 1; i++)
+            {
+                if (leftCount[i] == 0 || rightCount[i] == 0)
+                    continue;
+                float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestPosition = centroidMin[axis] + (i + 1) / scale;
+                }
+            }
+        }
+        if (bestAxis < 0)
+            return; // no split beats keeping the node a leaf
+
+        uint32_t* middle = std::partition(order.data() + first, order.data() + first + count,
+                                          [&](uint32_t primitive) { return centroid(bounds[primitive])[bestAxis] < bestPosition; });
+        uint32_t leftCount = static_cast<uint32_t>(middle - (order.data() + first));
+        if (leftCount == 0 || leftCount == count)
+            return; // rounding put every centroid on one side
+
+        uint32_t leftIndex = static_cast<uint32_t>(nodes.size());
+        BVHNode leftNode, rightNode;
+        leftNode.leftFirst = first;
+        leftNode.count = leftCount;
+        rightNode.leftFirst = first + leftCount;
+        rightNode.count = count - leftCount;
+        nodes.push_back(leftNode);
+        nodes.push_back(rightNode);
+        nodes[index].leftFirst = leftIndex;
+        nodes[index].count = 0;
+        updateNodeBox(leftIndex);
+        updateNodeBox(leftIndex + 1);
+        subdivide(leftIndex, depth + 1);
+        subdivide(leftIndex + 1, depth + 1);
+    }
+};
+#endif
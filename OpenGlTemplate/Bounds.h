@@ -0,0 +1,105 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// axis aligned box and bounding sphere of some geometry. The sphere is centered on the box and just large enough for
+// every vertex, which makes it tighter than the box's own bounding sphere. Plain floats only, so it can be written
+// to the mesh cache as is. Empty bounds have a negative radius.
+struct Bounds {
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 center;
+    float     radius;
+};
+static_assert(sizeof(Bounds) == 40, "Bounds is stored in the mesh cache, its size is part of the file layout");
+
+inline Bounds EmptyBounds()
+{
+    Bounds bounds;
+    bounds.min = glm::vec3(FLT_MAX);
+    bounds.max = glm::vec3(-FLT_MAX);
+    bounds.center = glm::vec3(0.0f);
+    bounds.radius = -1.0f;
+    return bounds;
+}
+
+inline bool IsEmpty(const Bounds& bounds)
+{
+    return bounds.radius < 0.0f;
+}
+
+// bounds of count positions read stride bytes apart
+inline Bounds ComputeBounds(const glm::vec3* positions, size_t count, size_t stride = sizeof(glm::vec3))
+{
+    Bounds bounds = EmptyBounds();
+    if (count == 0)
+        return bounds;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(positions);
+    for (size_t i = 0; i < count; i++)
+    {
+        const glm::vec3& position = *reinterpret_cast<const glm::vec3*>(bytes + i * stride);
+        bounds.min = glm::min(bounds.min, position);
+        bounds.max = glm::max(bounds.max, position);
+    }
+    bounds.center = (bounds.min + bounds.max) * 0.5f;
+    float radiusSquared = 0.0f;
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 offset = *reinterpret_cast<const glm::vec3*>(bytes + i * stride) - bounds.center;
+        radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+    }
+    bounds.radius = sqrt(radiusSquared);
+    return bounds;
+}
+
+// smallest bounds of this kind around both
+inline Bounds MergeBounds(const Bounds& a, const Bounds& b)
+{
+    if (IsEmpty(a))
+        return b;
+    if (IsEmpty(b))
+        return a;
+    Bounds merged;
+    merged.min = glm::min(a.min, b.min);
+    merged.max = glm::max(a.max, b.max);
+    merged.center = (merged.min + merged.max) * 0.5f;
+    merged.radius = std::max(glm::length(a.center - merged.center) + a.radius, glm::length(b.center - merged.center) + b.radius);
+    return merged;
+}
+
+// largest factor the matrix scales any direction by, what a bounding sphere's radius has to grow by
+inline float MaxScale(const glm::mat4& transform)
+{
+    float x = glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0]));
+    float y = glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1]));
+    float z = glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]));
+    return sqrt(std::max(x, std::max(y, z)));
+}
+
+// bounds around the transformed bounds (affine transforms only). The box is the box around the transformed box,
+// so it grows under rotation; the sphere stays exact up to non-uniform scale.
+inline Bounds TransformBounds(const Bounds& bounds, const glm::mat4& transform)
+{
+    if (IsEmpty(bounds))
+        return bounds;
+    glm::vec3 boxCenter = glm::vec3(transform * glm::vec4((bounds.min + bounds.max) * 0.5f, 1.0f));
+    glm::vec3 halfExtent = (bounds.max - bounds.min) * 0.5f;
+    glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(transform[0])), glm::abs(glm::vec3(transform[1])), glm::abs(glm::vec3(transform[2])));
+    glm::vec3 worldHalfExtent = absolute * halfExtent;
+
+    Bounds world;
+    world.min = boxCenter - worldHalfExtent;
+    world.max = boxCenter + worldHalfExtent;
+    world.center = glm::vec3(transform * glm::vec4(bounds.center, 1.0f));
+    world.radius = bounds.radius * MaxScale(transform);
+    return world;
+}
+#endif
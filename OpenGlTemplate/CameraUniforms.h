@@ -0,0 +1,56 @@
+#ifndef CAMERA_UNIFORMS_H
+#define CAMERA_UNIFORMS_H
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "RingBuffer.h"
+#include "Shader.h"
+
+#include <cstring>
+
+// mirrors the std140 layout of the Camera block in the vertex shaders:
+// layout (std140) uniform Camera { mat4 view; mat4 projection; mat4 viewProjection; vec3 cameraPos; float time; };
+struct CameraBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec3 cameraPos; // a vec3 takes 16 bytes in std140, time fills the last 4
+    float     time;
+};
+static_assert(sizeof(CameraBlock) == 208, "CameraBlock must match the std140 layout of the Camera block");
+
+// The per-frame camera data as a uniform block bound at CAMERA_BLOCK_BINDING. Every program reads it from there,
+// so it is written once per frame no matter how many shaders draw. The block lives in the frame's ring buffer section,
+// so writing it never waits for the GPU to finish the previous frame.
+class CameraUniforms
+{
+public:
+    explicit CameraUniforms(RingBuffer& ring)
+        : ring(ring)
+    {
+    }
+    CameraUniforms(const CameraUniforms&) = delete;
+    CameraUniforms& operator=(const CameraUniforms&) = delete;
+
+    // call once per frame after RingBuffer::BeginFrame()
+    void Update(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos, float time)
+    {
+        CameraBlock block;
+        block.view = view;
+        block.projection = projection;
+        block.viewProjection = projection * view;
+        block.cameraPos = cameraPos;
+        block.time = time;
+        GLintptr offset = 0;
+        void* data = ring.Allocate(sizeof(CameraBlock), ring.UniformAlignment(), offset);
+        if (!data)
+            return;
+        memcpy(data, &block, sizeof(CameraBlock));
+        glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, ring.Buffer(), offset, sizeof(CameraBlock));
+    }
+
+private:
+    RingBuffer& ring;
+};
+#endif
@@ -0,0 +1,196 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm/glm.hpp>
+
+#include "Bounds.h"
+
+#include <cmath>
+
+// SSE is part of every x64 target and of x86 builds with /arch:SSE or -msse, anything else takes the scalar path
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_SSE 1
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+// draws the culling pass kept and dropped, counted from RenderQueue::Begin() on
+struct CullStatistics {
+    unsigned int visible = 0;
+    unsigned int culled = 0;
+    // meshlets of the meshes that were kept
+    unsigned int meshletsVisible = 0;
+    unsigned int meshletsCulled = 0;
+};
+
+// The six planes of a view frustum in world space, extracted from a projection * view matrix (Gribb/Hartmann).
+// Planes are stored as structure of arrays, padded to eight by repeating the last two, so the SSE path tests a
+// volume against four planes per instruction. Tests are conservative: they may keep a volume that is just outside
+// near a corner, but never drop a visible one.
+class Frustum
+{
+public:
+    // a frustum that contains everything
+    Frustum()
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            x[i] = y[i] = z[i] = 0.0f;
+            w[i] = 1.0f;
+        }
+    }
+
+    explicit Frustum(const glm::mat4& viewProjection)
+    {
+        // glm is column major, row i is (m[0][i], m[1][i], m[2][i], m[3][i]). Clip space z runs from -w to w.
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        glm::vec4 planes[6] = {
+            rows[3] + rows[0], rows[3] - rows[0], // left, right
+            rows[3] + rows[1], rows[3] - rows[1], // bottom, top
+            rows[3] + rows[2], rows[3] - rows[2]  // near, far
+        };
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec4 plane = planes[i < 6 ? i : i - 2];
+            float length = glm::length(glm::vec3(plane));
+            if (length > 0.0f)
+                plane /= length;
+            x[i] = plane.x;
+            y[i] = plane.y;
+            z[i] = plane.z;
+            w[i] = plane.w;
+        }
+    }
+
+    // the same frustum in the space model maps to world space, for testing volumes without transforming each of them
+    Frustum Transformed(const glm::mat4& model) const
+    {
+        // a plane p in world space is transpose(model) * p in model space
+        Frustum transformed;
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec4 plane = glm::vec4(x[i], y[i], z[i], w[i]) * model;
+            float length = glm::length(glm::vec3(plane));
+            if (length > 0.0f)
+                plane /= length;
+            transformed.x[i] = plane.x;
+            transformed.y[i] = plane.y;
+            transformed.z[i] = plane.z;
+            transformed.w[i] = plane.w;
+        }
+        return transformed;
+    }
+
+    // false if the sphere lies entirely behind one of the planes
+    bool IntersectsSphere(const glm::vec3& center, float radius) const
+    {
+#ifdef FRUSTUM_SSE
+        __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+        __m128 negativeRadius = _mm_set1_ps(-radius);
+        int outside = 0;
+        for (int i = 0; i < 8; i += 4)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(x + i), cx), _mm_mul_ps(_mm_load_ps(y + i), cy)),
+                                         _mm_add_ps(_mm_mul_ps(_mm_load_ps(z + i), cz), _mm_load_ps(w + i)));
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(distance, negativeRadius));
+        }
+        return outside == 0;
+#else
+        for (int i = 0; i < 6; i++)
+        {
+            if (x[i] * center.x + y[i] * center.y + z[i] * center.z + w[i] < -radius)
+                return false;
+        }
+        return true;
+#endif
+    }
+
+    // false if the box lies entirely behind one of the planes: tests the corner furthest along each plane's normal
+    bool IntersectsBox(const glm::vec3& min, const glm::vec3& max) const
+    {
+#ifdef FRUSTUM_SSE
+        __m128 minX = _mm_set1_ps(min.x), minY = _mm_set1_ps(min.y), minZ = _mm_set1_ps(min.z);
+        __m128 maxX = _mm_set1_ps(max.x), maxY = _mm_set1_ps(max.y), maxZ = _mm_set1_ps(max.z);
+        __m128 zero = _mm_setzero_ps();
+        int outside = 0;
+        for (int i = 0; i < 8; i += 4)
+        {
+            __m128 nx = _mm_load_ps(x + i), ny = _mm_load_ps(y + i), nz = _mm_load_ps(z + i);
+            __m128 px = select(_mm_cmpgt_ps(nx, zero), maxX, minX);
+            __m128 py = select(_mm_cmpgt_ps(ny, zero), maxY, minY);
+            __m128 pz = select(_mm_cmpgt_ps(nz, zero), maxZ, minZ);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, px), _mm_mul_ps(ny, py)),
+                                         _mm_add_ps(_mm_mul_ps(nz, pz), _mm_load_ps(w + i)));
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(distance, zero));
+        }
+        return outside == 0;
+#else
+        for (int i = 0; i < 6; i++)
+        {
+            float px = x[i] > 0.0f ? max.x : min.x;
+            float py = y[i] > 0.0f ? max.y : min.y;
+            float pz = z[i] > 0.0f ? max.z : min.z;
+            if (x[i] * px + y[i] * py + z[i] * pz + w[i] < 0.0f)
+                return false;
+        }
+        return true;
+#endif
+    }
+
+    // true if the box lies entirely inside: tests the corner nearest along each plane's normal
+    bool ContainsBox(const glm::vec3& min, const glm::vec3& max) const
+    {
+#ifdef FRUSTUM_SSE
+        __m128 minX = _mm_set1_ps(min.x), minY = _mm_set1_ps(min.y), minZ = _mm_set1_ps(min.z);
+        __m128 maxX = _mm_set1_ps(max.x), maxY = _mm_set1_ps(max.y), maxZ = _mm_set1_ps(max.z);
+        __m128 zero = _mm_setzero_ps();
+        int outside = 0;
+        for (int i = 0; i < 8; i += 4)
+        {
+            __m128 nx = _mm_load_ps(x + i), ny = _mm_load_ps(y + i), nz = _mm_load_ps(z + i);
+            __m128 px = select(_mm_cmpgt_ps(nx, zero), minX, maxX);
+            __m128 py = select(_mm_cmpgt_ps(ny, zero), minY, maxY);
+            __m128 pz = select(_mm_cmpgt_ps(nz, zero), minZ, maxZ);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, px), _mm_mul_ps(ny, py)),
+                                         _mm_add_ps(_mm_mul_ps(nz, pz), _mm_load_ps(w + i)));
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(distance, zero));
+        }
+        return outside == 0;
+#else
+        for (int i = 0; i < 6; i++)
+        {
+            float px = x[i] > 0.0f ? min.x : max.x;
+            float py = y[i] > 0.0f ? min.y : max.y;
+            float pz = z[i] > 0.0f ? min.z : max.z;
+            if (x[i] * px + y[i] * py + z[i] * pz + w[i] < 0.0f)
+                return false;
+        }
+        return true;
+#endif
+    }
+
+    // the sphere test rejects most invisible volumes cheaply, the box catches long thin ones the sphere overestimates
+    bool Intersects(const Bounds& bounds) const
+    {
+        if (IsEmpty(bounds))
+            return false;
+        return IntersectsSphere(bounds.center, bounds.radius) && IntersectsBox(bounds.min, bounds.max);
+    }
+
+private:
+#ifdef FRUSTUM_SSE
+    static __m128 select(__m128 mask, __m128 a, __m128 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+#endif
+
+    alignas(16) float x[8];
+    alignas(16) float y[8];
+    alignas(16) float z[8];
+    alignas(16) float w[8];
+};
+#endif
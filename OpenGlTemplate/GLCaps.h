@@ -0,0 +1,117 @@
+#ifndef GL_CAPS_H
+#define GL_CAPS_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <unordered_set>
+
+using namespace std;
+
+// tokens of the optional features below, glad was generated for plain 3.3 core and does not know them
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRYP GLMultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP GLGetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP GLProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP GLProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP GLMaxShaderCompilerThreadsProc)(GLuint count);
+typedef void (APIENTRYP GLBufferStorageProc)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// What the context offers beyond OpenGL 3.3 core. Call Load() once right after glad with the same loader,
+// then check the feature flags before touching any of the function pointers; they stay null when unsupported.
+class GLCaps
+{
+public:
+    static GLCaps& Get()
+    {
+        static GLCaps caps;
+        return caps;
+    }
+
+    int majorVersion = 3;
+    int minorVersion = 3;
+
+    // glMultiDrawElementsIndirect: 4.3 or ARB_multi_draw_indirect
+    bool multiDrawIndirect = false;
+    GLMultiDrawElementsIndirectProc MultiDrawElementsIndirect = nullptr;
+
+    // glGetProgramBinary/glProgramBinary: 4.1 or ARB_get_program_binary, with at least one binary format
+    bool programBinary = false;
+    GLGetProgramBinaryProc GetProgramBinary = nullptr;
+    GLProgramBinaryProc ProgramBinary = nullptr;
+    GLProgramParameteriProc ProgramParameteri = nullptr;
+
+    // GL_COMPLETION_STATUS_KHR and glMaxShaderCompilerThreadsKHR: KHR_parallel_shader_compile (or the ARB version)
+    bool parallelShaderCompile = false;
+    GLMaxShaderCompilerThreadsProc MaxShaderCompilerThreads = nullptr;
+
+    // glBufferStorage, for persistently mapped buffers: 4.4 or ARB_buffer_storage
+    bool bufferStorage = false;
+    GLBufferStorageProc BufferStorage = nullptr;
+
+    void Load(GLADloadproc load)
+    {
+        glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+        glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+            extensions.insert(reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i)));
+
+        if (AtLeast(4, 3) || HasExtension("GL_ARB_multi_draw_indirect"))
+        {
+            MultiDrawElementsIndirect = reinterpret_cast<GLMultiDrawElementsIndirectProc>(load("glMultiDrawElementsIndirect"));
+            multiDrawIndirect = MultiDrawElementsIndirect != nullptr;
+        }
+        if (AtLeast(4, 1) || HasExtension("GL_ARB_get_program_binary"))
+        {
+            GetProgramBinary = reinterpret_cast<GLGetProgramBinaryProc>(load("glGetProgramBinary"));
+            ProgramBinary = reinterpret_cast<GLProgramBinaryProc>(load("glProgramBinary"));
+            ProgramParameteri = reinterpret_cast<GLProgramParameteriProc>(load("glProgramParameteri"));
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            programBinary = GetProgramBinary && ProgramBinary && ProgramParameteri && formats > 0;
+        }
+        if (HasExtension("GL_KHR_parallel_shader_compile"))
+            MaxShaderCompilerThreads = reinterpret_cast<GLMaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsKHR"));
+        else if (HasExtension("GL_ARB_parallel_shader_compile"))
+            MaxShaderCompilerThreads = reinterpret_cast<GLMaxShaderCompilerThreadsProc>(load("glMaxShaderCompilerThreadsARB"));
+        parallelShaderCompile = MaxShaderCompilerThreads != nullptr;
+        if (AtLeast(4, 4) || HasExtension("GL_ARB_buffer_storage"))
+        {
+            BufferStorage = reinterpret_cast<GLBufferStorageProc>(load("glBufferStorage"));
+            bufferStorage = BufferStorage != nullptr;
+        }
+    }
+
+    bool AtLeast(int major, int minor) const
+    {
+        return majorVersion > major || (majorVersion == major && minorVersion >= minor);
+    }
+
+    bool HasExtension(const string& name) const
+    {
+        return extensions.count(name) > 0;
+    }
+
+private:
+    unordered_set<string> extensions;
+
+    GLCaps() {}
+};
+#endif
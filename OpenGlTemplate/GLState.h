@@ -0,0 +1,202 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Shadow copy of the GL state the renderer changes most, so setting a value that is already current costs no GL call.
+// It only works if every change of the tracked state goes through here: code that binds or deletes behind its back
+// has to call the matching Forget...() or Invalidate(). Counts issued and skipped calls per frame. GL thread only.
+class GLState
+{
+public:
+    static GLState& Get()
+    {
+        static GLState state;
+        return state;
+    }
+
+    void UseProgram(GLuint program)
+    {
+        if (set(currentProgram, program))
+            glUseProgram(program);
+    }
+
+    void BindVertexArray(GLuint vertexArray)
+    {
+        if (set(currentVertexArray, vertexArray))
+            glBindVertexArray(vertexArray);
+    }
+
+    // unit is an index (0, 1, ...), not GL_TEXTUREi
+    void ActiveTexture(unsigned int unit)
+    {
+        if (set(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // binds a 2D texture to the unit, switching the active unit only when the binding actually changes
+    void BindTexture(unsigned int unit, GLuint texture)
+    {
+        if (unit >= boundTextures.size())
+            boundTextures.resize(unit + 1, UNKNOWN);
+        if (boundTextures[unit] == texture)
+        {
+            skipped++;
+            return;
+        }
+        ActiveTexture(unit);
+        boundTextures[unit] = texture;
+        issued++;
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+
+    // binds a 2D texture to whichever unit is active, for code that only needs some binding point to work on
+    void BindTexture(GLuint texture)
+    {
+        if (activeUnit == UNKNOWN)
+            ActiveTexture(0);
+        BindTexture(activeUnit, texture);
+    }
+
+    void Enable(GLenum capability)
+    {
+        setCapability(capability, true);
+    }
+
+    void Disable(GLenum capability)
+    {
+        setCapability(capability, false);
+    }
+
+    // whether the capability is on as last set through Enable/Disable, false if it never was
+    bool IsEnabled(GLenum capability) const
+    {
+        unordered_map<GLenum, bool>::const_iterator found = capabilities.find(capability);
+        return found != capabilities.end() && found->second;
+    }
+
+    void StencilFunc(GLenum func, GLint ref, GLuint mask)
+    {
+        if (stencilFunc == func && stencilRef == static_cast<GLuint>(ref) && stencilFuncMask == mask)
+        {
+            skipped++;
+            return;
+        }
+        stencilFunc = func;
+        stencilRef = static_cast<GLuint>(ref);
+        stencilFuncMask = mask;
+        issued++;
+        glStencilFunc(func, ref, mask);
+    }
+
+    void StencilMask(GLuint mask)
+    {
+        if (set(stencilWriteMask, mask))
+            glStencilMask(mask);
+    }
+
+    // the texture is being deleted, GL unbinds it from every unit
+    void ForgetTexture(GLuint texture)
+    {
+        for (GLuint& bound : boundTextures)
+        {
+            if (bound == texture)
+                bound = 0;
+        }
+    }
+
+    // buffer and byte offset a VAO's instance attributes read from (see InstanceBuffer::Attach), (0, 0) if not set up
+    pair<GLuint, GLintptr>& InstanceSource(GLuint vertexArray)
+    {
+        return instanceSources[vertexArray];
+    }
+
+    // the vertex array is being deleted, GL unbinds it if it is current. Its id may come back for a new VAO, which
+    // must not look set up already.
+    void ForgetVertexArray(GLuint vertexArray)
+    {
+        if (currentVertexArray == vertexArray)
+            currentVertexArray = 0;
+        instanceSources.erase(vertexArray);
+    }
+
+    // the buffer is being deleted, VAOs that read instance attributes from it have to be pointed anew
+    void ForgetInstanceBuffer(GLuint buffer)
+    {
+        for (unordered_map<GLuint, pair<GLuint, GLintptr>>::iterator it = instanceSources.begin(); it != instanceSources.end();)
+            it = it->second.first == buffer ? instanceSources.erase(it) : ++it;
+    }
+
+    // forgets everything, the next call of each kind goes to GL
+    void Invalidate()
+    {
+        currentProgram = currentVertexArray = activeUnit = UNKNOWN;
+        boundTextures.clear();
+        capabilities.clear();
+        instanceSources.clear();
+        stencilFunc = stencilRef = stencilFuncMask = stencilWriteMask = UNKNOWN;
+    }
+
+    // closes the frame's counters, read them back with IssuedLastFrame()/SkippedLastFrame()
+    void EndFrame()
+    {
+        issuedLastFrame = issued;
+        skippedLastFrame = skipped;
+        issued = skipped = 0;
+    }
+
+    unsigned int IssuedLastFrame() const { return issuedLastFrame; }
+    unsigned int SkippedLastFrame() const { return skippedLastFrame; }
+
+private:
+    static const GLuint UNKNOWN = ~0u;
+
+    GLuint currentProgram = UNKNOWN;
+    GLuint currentVertexArray = UNKNOWN;
+    GLuint activeUnit = UNKNOWN;
+    vector<GLuint> boundTextures;
+    unordered_map<GLenum, bool> capabilities;
+    unordered_map<GLuint, pair<GLuint, GLintptr>> instanceSources;
+    GLuint stencilFunc = UNKNOWN, stencilRef = UNKNOWN, stencilFuncMask = UNKNOWN, stencilWriteMask = UNKNOWN;
+
+    unsigned int issued = 0, skipped = 0;
+    unsigned int issuedLastFrame = 0, skippedLastFrame = 0;
+
+    GLState() {}
+
+    // stores the value and reports whether it changed, counting the call as issued or skipped
+    bool set(GLuint& current, GLuint value)
+    {
+        if (current == value)
+        {
+            skipped++;
+            return false;
+        }
+        current = value;
+        issued++;
+        return true;
+    }
+
+    void setCapability(GLenum capability, bool enabled)
+    {
+        unordered_map<GLenum, bool>::iterator found = capabilities.find(capability);
+        if (found != capabilities.end() && found->second == enabled)
+        {
+            skipped++;
+            return;
+        }
+        capabilities[capability] = enabled;
+        issued++;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+};
+#endif
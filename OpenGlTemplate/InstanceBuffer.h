@@ -0,0 +1,91 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "GLState.h"
+#include "mesh.h"
+#include "RingBuffer.h"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Per-instance model matrices for instanced drawing, either kept in a buffer of their own (Update) or written into the
+// frame's ring buffer (Stream). Attach() wires them to a VAO as the ATTRIBUTE_INSTANCE_MODEL columns (divisor 1);
+// that sticks with the VAO, so it only costs GL calls the first time or when the VAO was pointed at other instance
+// data in between. Streamed data moves every frame, so it is attached again each frame. What each VAO reads from is
+// tracked by GLState, which forgets it when the VAO is deleted. GL thread only.
+class InstanceBuffer
+{
+public:
+    InstanceBuffer()
+    {
+        glGenBuffers(1, &VBO);
+    }
+    ~InstanceBuffer()
+    {
+        GLState::Get().ForgetInstanceBuffer(VBO);
+        glDeleteBuffers(1, &VBO);
+    }
+    InstanceBuffer(const InstanceBuffer&) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer&) = delete;
+
+    // replaces the transforms, the buffer is orphaned so the GPU can keep reading the old contents
+    void Update(const vector<glm::mat4>& transforms)
+    {
+        count = static_cast<GLsizei>(transforms.size());
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        source = AttachedSource(VBO, 0);
+    }
+
+    // writes this frame's transforms into the ring instead, call after RingBuffer::BeginFrame() and flush the ring
+    // before drawing
+    void Stream(RingBuffer& ring, const vector<glm::mat4>& transforms)
+    {
+        count = 0;
+        if (transforms.empty())
+            return;
+        GLintptr offset = 0;
+        void* data = ring.Allocate(transforms.size() * sizeof(glm::mat4), sizeof(glm::vec4), offset);
+        if (!data)
+            return;
+        memcpy(data, transforms.data(), transforms.size() * sizeof(glm::mat4));
+        count = static_cast<GLsizei>(transforms.size());
+        source = AttachedSource(ring.Buffer(), offset);
+    }
+
+    // makes the bound VAO read its instance attributes from this buffer
+    void Attach(GLuint vertexArray) const
+    {
+        AttachedSource& attached = GLState::Get().InstanceSource(vertexArray);
+        if (attached == source)
+            return;
+        attached = source;
+        glBindBuffer(GL_ARRAY_BUFFER, source.first);
+        for (GLuint column = 0; column < 4; column++)
+        {
+            GLuint location = ATTRIBUTE_INSTANCE_MODEL + column;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(source.second + column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(location, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    GLsizei Count() const { return count; }
+
+private:
+    // buffer and byte offset the transforms are read from
+    typedef pair<GLuint, GLintptr> AttachedSource;
+
+    unsigned int VBO = 0;
+    GLsizei count = 0;
+    AttachedSource source = AttachedSource(0, 0);
+};
+#endif
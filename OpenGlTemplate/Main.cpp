@@ -5,16 +5,32 @@
 #include <glm/glm/gtc/matrix_transform.hpp>
 #include <glm/glm/gtc/type_ptr.hpp>
 
+// the counting operator new/delete, compiled in only when the build defines ALLOCATION_STATS
+#define ALLOCATION_COUNTER_IMPLEMENTATION
+#include "AllocationCounter.h"
+#include "BVH.h"
 #include "Camera.h"
+#include "CameraUniforms.h"
+#include "Frustum.h"
+#include "GLCaps.h"
+#include "GLState.h"
+#include "InstanceBuffer.h"
+#include "Ray.h"
 #include "Shader.h"
+#include "ShaderManager.h"
 #include "model.h"
+#include "RenderQueue.h"
+#include "RingBuffer.h"
+#include "ScreenOutline.h"
 
+#include <cstdio>
 #include <iostream>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
+void updateWindowTitle(GLFWwindow* window, float currentFrame, const CullStatistics& culling);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
@@ -29,6 +45,21 @@ bool firstMouse = true;
 float deltaTime = 0.0f;	// Time between current frame and last frame
 float lastFrame = 0.0f; // Time of last frame
 
+// outline, the model redrawn scaled up by default; O switches to the screen-space pass and back
+OutlineMode outlineMode = OUTLINE_GEOMETRY;
+bool outlineKeyDown = false;
+
+// G switches between the single model and a grid of instanced copies
+bool drawGrid = false;
+bool gridKeyDown = false;
+const int GRID_SIZE = 32;
+const float GRID_SPACING = 3.0f;
+// left click picks the model under the cursor
+bool pickRequested = false;
+bool pickButtonDown = false;
+// room for one frame of streamed data: camera block, per-draw transforms and the grid's instance transforms
+const size_t FRAME_DATA_BYTES = 1 << 20;
+
 // lighting
 float yLightStartingPos = 1.0f;
 glm::vec3 lightPos = glm::vec3(1.0, 1.0f, -1.0f);
@@ -67,87 +98,208 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    // optional features past 3.3, used when the driver has them
+    GLCaps::Get().Load((GLADloadproc)glfwGetProcAddress);
 
     stbi_set_flip_vertically_on_load(true);
    
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_STENCIL_TEST);
+    // state the frame toggles goes through GLState, which drops calls that would not change anything
+    GLState& glState = GLState::Get();
+    glState.Enable(GL_DEPTH_TEST);
+    glState.Enable(GL_STENCIL_TEST);
     glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-    glStencilFunc(GL_ALWAYS, 1, 0xFF); // all fragments should pass the stencil test
-
-    // build and compile our shader zprogram
-    // ------------------------------------
-    Shader lightingShader("3.3.shader.vs", "3.3.shader.frs");
-    Shader lightCubeShader("1.light_cube.vs", "1.light_cube.frs");
-    Shader outlineShader("1.light_cube.vs", "simplecolor.frag");
+    glState.StencilFunc(GL_ALWAYS, 1, 0xFF); // all fragments should pass the stencil test
 
-    Model ourModel("ModelBP/backpack.obj");
+    // GL objects live in this scope so they are released while the context still exists
+    {
+        // build and compile our shader zprogram
+        // the programs build in the background while the model loads, each is waited for on first use
+        // ------------------------------------
+        ShaderManager shaders;
+        Shader& lightingShader = shaders.Load("3.3.shader.vs", "3.3.shader.frs");
+        Shader& outlineShader = shaders.Load("1.light_cube.vs", "simplecolor.frag");
+        Shader& instancedShader = shaders.Load("instanced.vs", "3.3.shader.frs");
+        Shader& instancedOutlineShader = shaders.Load("instanced.vs", "simplecolor.frag");
+
+        // the plain defaults. Each ModelOptions field switches on one import or draw path by itself (see model.h),
+        // turn them on one at a time so a change in behaviour traces back to a single option
+        ModelOptions modelOptions;
+        Model ourModel("ModelBP/backpack.obj", false, modelOptions);
+
+        // everything written per frame goes through the ring, view/projection once for every shader
+        RingBuffer frameData(FRAME_DATA_BYTES);
+        CameraUniforms cameraUniforms(frameData);
+        RenderQueue renderQueue(frameData);
+        ScreenOutline screenOutline(shaders);
+
+        // GRID_SIZE x GRID_SIZE backpacks on the ground plane, drawn with one instanced call per mesh
+        std::vector<glm::mat4> gridTransforms, gridOutlineTransforms;
+        for (int z = 0; z < GRID_SIZE; z++)
+        {
+            for (int x = 0; x < GRID_SIZE; x++)
+            {
+                glm::vec3 offset((x - GRID_SIZE / 2) * GRID_SPACING, 0.0f, -z * GRID_SPACING);
+                glm::mat4 transform = glm::translate(glm::mat4(1.0f), offset);
+                gridTransforms.push_back(transform);
+                gridOutlineTransforms.push_back(glm::scale(transform, glm::vec3(1.1f, 1.1f, 1.1f)));
+            }
+        }
+        // BVHs over the world space bounds of the grid copies, for culling and picking
+        std::vector<Bounds> gridBounds, gridOutlineBounds;
+        for (size_t i = 0; i < gridTransforms.size(); i++)
+        {
+            gridBounds.push_back(TransformBounds(ourModel.bounds, gridTransforms[i]));
+            gridOutlineBounds.push_back(TransformBounds(ourModel.bounds, gridOutlineTransforms[i]));
+        }
+        BVH gridBVH, gridOutlineBVH;
+        gridBVH.Build(gridBounds);
+        gridOutlineBVH.Build(gridOutlineBounds);
+        // one instance buffer per level of detail, each copy goes into the one its distance calls for
+        InstanceBuffer gridInstances[MAX_MESH_LODS], gridOutlineInstances[MAX_MESH_LODS];
+        // the grid transforms that pass frustum culling this frame, and those split by level of detail
+        std::vector<glm::mat4> visibleGrid;
+        std::vector<glm::mat4> gridLodTransforms[MAX_MESH_LODS];
+        auto submitGrid = [&](RenderPass pass, Shader& shader, const BVH& bvh, const std::vector<glm::mat4>& transforms, InstanceBuffer* instances)
+        {
+            renderQueue.CullInstances(bvh, transforms, visibleGrid, pass);
+            for (std::vector<glm::mat4>& lodTransforms : gridLodTransforms)
+                lodTransforms.clear();
+            for (const glm::mat4& transform : visibleGrid)
+                gridLodTransforms[ourModel.SelectLod(renderQueue, transform)].push_back(transform);
+            for (int lod = 0; lod < ourModel.LodCount(); lod++)
+            {
+                instances[lod].Stream(frameData, gridLodTransforms[lod]);
+                ourModel.SubmitInstanced(renderQueue, pass, shader, instances[lod], lod);
+            }
+        };
 
   
-    // render loop
-    // -----------
-    while (!glfwWindowShouldClose(window))
-    {
-        // per-frame time logic
-        // --------------------
-        float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
-
-        // input
-        // -----
-        processInput(window);
-
-        // render
-        // ------
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
-        glStencilFunc(GL_ALWAYS, 1, 0xFF);
-        glStencilMask(0xFF);
-
-        //using shader
-        lightingShader.use();
-
-
-        // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        lightingShader.setMat4("projection", projection);
-        lightingShader.setMat4("view", view);
-
-        // render the loaded model
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
-        model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));	// it's a bit too big for our scene, so scale it down
-        lightingShader.setMat4("model", model);
-        ourModel.Draw(lightingShader);
-
-        //render outline
-        glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-        glStencilMask(0x00); // disable writing to the stencil buffer
-        glDisable(GL_DEPTH_TEST);
-        model = glm::mat4(1.0f);
-        model = glm::scale(model, glm::vec3(1.1f, 1.1f, 1.1f));	// it's a bit too big for our scene, so scale it down
-        outlineShader.use();
-        outlineShader.setMat4("projection", projection);
-        outlineShader.setMat4("view", view);
-        outlineShader.setMat4("model", model);
-        ourModel.Draw(outlineShader);
-        glStencilMask(0xFF);
-        glStencilFunc(GL_ALWAYS, 0, 0xFF);
-        glEnable(GL_DEPTH_TEST);
-
-
-        // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-        // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        // render loop
+        // -----------
+        while (!glfwWindowShouldClose(window))
+        {
+            // per-frame time logic
+            // --------------------
+            float currentFrame = static_cast<float>(glfwGetTime());
+            deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+
+            // input
+            // -----
+            processInput(window);
+
+            // upload textures that finished decoding in the background, meshes use a placeholder until then
+            TextureLoader::Shared().Pump();
+            // pick up programs the driver finished since the last frame
+            shaders.Poll();
+
+            // render
+            // ------
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            int framebufferWidth, framebufferHeight;
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+            if (outlineMode == OUTLINE_SCREEN_SPACE)
+            {
+                // the screen-space outline needs the scene offscreen, that target gets cleared instead
+                screenOutline.BeginScene(framebufferWidth, framebufferHeight);
+            }
+            else
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+            // view/projection transformations
+            const float farPlane = 100.0f;
+            glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, farPlane);
+            glm::mat4 view = camera.GetViewMatrix();
+            frameData.BeginFrame();
+            cameraUniforms.Update(view, projection, camera.Position, currentFrame);
+
+            // record this frame's draws, the queue sorts them by pass, program, textures and geometry
+            if (pickRequested)
+            {
+                pickRequested = false;
+                double cursorX, cursorY;
+                int windowWidth, windowHeight;
+                glfwGetCursorPos(window, &cursorX, &cursorY);
+                glfwGetWindowSize(window, &windowWidth, &windowHeight);
+                Ray ray = ScreenRay(static_cast<float>(cursorX), static_cast<float>(cursorY), static_cast<float>(windowWidth),
+                                    static_cast<float>(windowHeight), glm::inverse(projection * view));
+                RayHit hit = { 0, 0.0f };
+                size_t hitMesh = 0;
+                bool picked;
+                if (drawGrid)
+                    picked = gridBVH.Raycast(ray, farPlane, hit, [&](uint32_t instance, const Ray& instanceRay, float maxDistance, float& distance)
+                    {
+                        return ourModel.Intersect(gridTransforms[instance], instanceRay, maxDistance, distance, hitMesh);
+                    });
+                else
+                    picked = ourModel.Intersect(glm::mat4(1.0f), ray, farPlane, hit.distance, hitMesh);
+                if (picked)
+                    std::cout << "Pick: instance " << hit.primitive << ", mesh " << hitMesh << " at distance " << hit.distance << std::endl;
+                else
+                    std::cout << "Pick: nothing under the cursor" << std::endl;
+            }
+
+            // meshes and grid instances outside the view frustum are not submitted at all
+            renderQueue.Begin(camera.Position, farPlane, Frustum(projection * view));
+            // distant meshes are drawn at the coarsest level of detail that stays within a pixel of the full mesh
+            renderQueue.SetLodProjection(static_cast<float>(framebufferHeight), glm::radians(camera.Zoom));
+
+            // render the loaded model, with the node transforms of its file
+            ourModel.UpdateTransforms();
+            glm::mat4 model = glm::mat4(1.0f);
+            model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
+            model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));	// it's a bit too big for our scene, so scale it down
+            if (drawGrid)
+            {
+                submitGrid(RENDER_PASS_OPAQUE, instancedShader, gridBVH, gridTransforms, gridInstances);
+            }
+            else
+                ourModel.Submit(renderQueue, RENDER_PASS_OPAQUE, lightingShader, model);
+
+            //render outline
+            if (outlineMode == OUTLINE_GEOMETRY)
+            {
+                model = glm::mat4(1.0f);
+                model = glm::scale(model, glm::vec3(1.1f, 1.1f, 1.1f));	// it's a bit too big for our scene, so scale it down
+                if (drawGrid)
+                {
+                    submitGrid(RENDER_PASS_OUTLINE, instancedOutlineShader, gridOutlineBVH, gridOutlineTransforms, gridOutlineInstances);
+                }
+                else
+                    ourModel.Submit(renderQueue, RENDER_PASS_OUTLINE, outlineShader, model);
+            }
+
+            renderQueue.Sort();
+            frameData.Flush();
+
+            glState.StencilFunc(GL_ALWAYS, 1, 0xFF);
+            glState.StencilMask(0xFF);
+            renderQueue.Execute(RENDER_PASS_OPAQUE);
+
+            if (outlineMode == OUTLINE_SCREEN_SPACE)
+                screenOutline.Resolve();
+            else
+            {
+                glState.StencilFunc(GL_NOTEQUAL, 1, 0xFF);
+                glState.StencilMask(0x00); // disable writing to the stencil buffer
+                glState.Disable(GL_DEPTH_TEST);
+                renderQueue.Execute(RENDER_PASS_OUTLINE);
+                glState.StencilMask(0xFF);
+                glState.StencilFunc(GL_ALWAYS, 0, 0xFF);
+                glState.Enable(GL_DEPTH_TEST);
+            }
+            frameData.EndFrame();
+            glState.EndFrame();
+            updateWindowTitle(window, currentFrame, renderQueue.Culling());
+
+
+            // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+            // -------------------------------------------------------------------------------
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
     }
 
-
-
-
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
@@ -169,6 +321,39 @@ void processInput(GLFWwindow* window)
         camera.ProcessKeyboard(LEFT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         camera.ProcessKeyboard(RIGHT, deltaTime);
+
+    // toggle once per key press, not every frame it is held
+    bool outlineKeyPressed = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (outlineKeyPressed && !outlineKeyDown)
+        outlineMode = outlineMode == OUTLINE_SCREEN_SPACE ? OUTLINE_GEOMETRY : OUTLINE_SCREEN_SPACE;
+    outlineKeyDown = outlineKeyPressed;
+    bool gridKeyPressed = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (gridKeyPressed && !gridKeyDown)
+        drawGrid = !drawGrid;
+    gridKeyDown = gridKeyPressed;
+    bool pickButtonPressed = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    if (pickButtonPressed && !pickButtonDown)
+        pickRequested = true;
+    pickButtonDown = pickButtonPressed;
+}
+
+// shows frame rate, GL state and culling statistics in the title bar, refreshed once per second
+// ---------------------------------------------------------------------------------------------------------
+void updateWindowTitle(GLFWwindow* window, float currentFrame, const CullStatistics& culling)
+{
+    static float lastUpdate = 0.0f;
+    static unsigned int frames = 0;
+    frames++;
+    if (currentFrame - lastUpdate < 1.0f)
+        return;
+
+    char title[384];
+    snprintf(title, sizeof(title), "LearnOpenGL | %.0f fps | state calls per frame: %u issued, %u skipped | culling: %u visible, %u culled | meshlets: %u visible, %u culled | outline: %s (O) | %s (G)",
+             frames / (currentFrame - lastUpdate), GLState::Get().IssuedLastFrame(), GLState::Get().SkippedLastFrame(), culling.visible, culling.culled,
+             culling.meshletsVisible, culling.meshletsCulled, outlineMode == OUTLINE_SCREEN_SPACE ? "screen-space" : "geometry", drawGrid ? "instanced grid" : "single model");
+    glfwSetWindowTitle(window, title);
+    lastUpdate = currentFrame;
+    frames = 0;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
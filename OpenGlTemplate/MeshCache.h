@@ -0,0 +1,461 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "Hash.h"
+#include "mesh.h"
+#include "SceneGraph.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <vector>
+
+#ifdef _WIN32
+#ifdef APIENTRY
+#undef APIENTRY // glad already defined it, windows.h defines it again with the same meaning
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// bump this whenever the file layout (or the Vertex struct) changes, older caches are then simply rebuilt
+const uint32_t MESH_CACHE_VERSION = 5;
+const char MESH_CACHE_MAGIC[4] = { 'B', 'P', 'M', 'C' };
+const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+// file layout: header, mesh records, scene nodes, levels of detail, meshlets, texture references, string blob, vertices, indices.
+// every section starts on a 16 byte boundary so the file can be memory mapped and read in place.
+struct MeshCacheHeader {
+    char     magic[4];
+    uint32_t version;
+    // FNV-1a hash of the source asset, a changed file invalidates the cache
+    uint64_t sourceHash;
+    // assimp post-process flags the meshes were imported with
+    uint32_t importFlags;
+    // our own import options that change the cached data
+    uint32_t optionFlags;
+    // sizeof(Vertex) when the cache was written
+    uint32_t vertexStride;
+    uint32_t meshCount;
+    uint32_t nodeCount;
+    uint32_t lodCount;
+    uint32_t meshletCount;
+    uint32_t textureCount;
+    uint32_t stringSize;
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    // section offsets from the start of the file
+    uint64_t meshOffset;
+    uint64_t nodeOffset;
+    uint64_t lodOffset;
+    uint64_t meshletOffset;
+    uint64_t textureOffset;
+    uint64_t stringOffset;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t fileSize;
+};
+
+// per-mesh ranges into the shared vertex, index and texture sections
+struct MeshCacheRecord {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t firstTexture;
+    uint32_t textureCount;
+    Bounds   bounds;
+    uint32_t node;
+    // the mesh's levels of detail, their index ranges are relative to the mesh's own indices
+    uint32_t firstLod;
+    uint32_t lodCount;
+    // the mesh's meshlets, their index ranges are relative to the mesh's own indices too
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
+};
+
+// a scene graph node in preorder, parent is SCENE_NO_PARENT or an earlier node
+struct MeshCacheNode {
+    uint32_t parent;
+    float    local[16]; // column major
+};
+
+// a material texture reference, both strings live in the string blob
+struct MeshCacheTexture {
+    uint32_t typeOffset;
+    uint32_t typeLength;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+// read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const string& path)
+    {
+        Close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+        {
+            Close();
+            return false;
+        }
+        bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            Close();
+            return false;
+        }
+        void* view = mmap(NULL, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        bytes = view == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(view);
+        length = static_cast<size_t>(info.st_size);
+#endif
+        if (!bytes)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes)
+            munmap(const_cast<unsigned char*>(bytes), length);
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const unsigned char* Data() const { return bytes; }
+    size_t Size() const { return length; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+};
+
+// hashes the content of a file, returns false if it can't be read
+inline bool HashFile(const string& path, uint64_t& hash)
+{
+    MappedFile file;
+    if (!file.Open(path))
+        return false;
+    hash = HashBytes(file.Data(), file.Size());
+    return true;
+}
+
+// hashes a model file together with the material libraries it references ("mtllib" lines of an OBJ, relative to
+// the model's directory), whose texture paths end up in the cache too. A library that can't be read still changes
+// the hash through its name, so adding it later invalidates the cache.
+inline bool HashModelSources(const string& path, uint64_t& hash)
+{
+    MappedFile file;
+    if (!file.Open(path))
+        return false;
+    hash = HashBytes(file.Data(), file.Size());
+
+    string directory = path.substr(0, path.find_last_of('/') + 1);
+    const char* text = reinterpret_cast<const char*>(file.Data());
+    size_t size = file.Size();
+    for (size_t line = 0; line < size;)
+    {
+        size_t end = line;
+        while (end < size && text[end] != '\n')
+            end++;
+        if (end - line > 7 && strncmp(text + line, "mtllib ", 7) == 0)
+        {
+            string name(text + line + 7, end - line - 7);
+            while (!name.empty() && (name.back() == '\r' || name.back() == ' ' || name.back() == '\t'))
+                name.pop_back();
+            hash = HashBytes(name.data(), name.size(), hash);
+            uint64_t libraryHash = 0;
+            if (HashFile(directory + name, libraryHash))
+                hash = HashBytes(&libraryHash, sizeof(libraryHash), hash);
+        }
+        line = end + 1;
+    }
+    return true;
+}
+
+// validated, zero-copy view of a cache file
+class MeshCacheReader
+{
+public:
+    // maps the cache and checks that it matches the source asset and import settings
+    bool Open(const string& cachePath, uint64_t sourceHash, uint32_t importFlags, uint32_t optionFlags)
+    {
+        if (!file.Open(cachePath))
+            return false;
+        if (file.Size() < sizeof(MeshCacheHeader))
+            return fail();
+        header = reinterpret_cast<const MeshCacheHeader*>(file.Data());
+        if (memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC)) != 0 || header->version != MESH_CACHE_VERSION)
+            return fail();
+        if (header->sourceHash != sourceHash || header->importFlags != importFlags || header->optionFlags != optionFlags)
+            return fail();
+        if (header->vertexStride != sizeof(Vertex) || header->fileSize != file.Size())
+            return fail();
+        if (!sectionFits(header->meshOffset, header->meshCount, sizeof(MeshCacheRecord)) ||
+            !sectionFits(header->nodeOffset, header->nodeCount, sizeof(MeshCacheNode)) ||
+            !sectionFits(header->lodOffset, header->lodCount, sizeof(MeshLod)) ||
+            !sectionFits(header->meshletOffset, header->meshletCount, sizeof(Meshlet)) ||
+            !sectionFits(header->textureOffset, header->textureCount, sizeof(MeshCacheTexture)) ||
+            !sectionFits(header->stringOffset, header->stringSize, 1) ||
+            !sectionFits(header->vertexOffset, header->vertexCount, sizeof(Vertex)) ||
+            !sectionFits(header->indexOffset, header->indexCount, sizeof(unsigned int)))
+            return fail();
+
+        for (uint32_t i = 0; i < header->meshCount; i++)
+        {
+            const MeshCacheRecord& record = Record(i);
+            if (uint64_t(record.firstVertex) + record.vertexCount > header->vertexCount ||
+                uint64_t(record.firstIndex) + record.indexCount > header->indexCount ||
+                uint64_t(record.firstTexture) + record.textureCount > header->textureCount || record.node >= header->nodeCount ||
+                uint64_t(record.firstLod) + record.lodCount > header->lodCount || record.lodCount > MAX_MESH_LODS ||
+                uint64_t(record.firstMeshlet) + record.meshletCount > header->meshletCount)
+                return fail();
+            for (uint32_t j = 0; j < record.lodCount; j++)
+            {
+                const MeshLod& lod = Lods()[record.firstLod + j];
+                if (uint64_t(lod.firstIndex) + lod.indexCount > record.indexCount || lod.indexCount % 3 != 0)
+                    return fail();
+            }
+            for (uint32_t j = 0; j < record.meshletCount; j++)
+            {
+                const Meshlet& meshlet = Meshlets()[record.firstMeshlet + j];
+                if (uint64_t(meshlet.firstIndex) + meshlet.indexCount > record.indexCount)
+                    return fail();
+            }
+            const unsigned int* indices = Indices() + record.firstIndex;
+            for (uint32_t j = 0; j < record.indexCount; j++)
+                if (indices[j] >= record.vertexCount)
+                    return fail();
+        }
+        for (uint32_t i = 0; i < header->nodeCount; i++)
+        {
+            if (Node(i).parent != SCENE_NO_PARENT && Node(i).parent >= i)
+                return fail();
+        }
+        for (uint32_t i = 0; i < header->textureCount; i++)
+        {
+            const MeshCacheTexture& texture = textures()[i];
+            if (uint64_t(texture.typeOffset) + texture.typeLength > header->stringSize ||
+                uint64_t(texture.pathOffset) + texture.pathLength > header->stringSize)
+                return fail();
+        }
+        return true;
+    }
+
+    uint32_t MeshCount() const { return header->meshCount; }
+    const MeshCacheRecord& Record(uint32_t i) const { return reinterpret_cast<const MeshCacheRecord*>(file.Data() + header->meshOffset)[i]; }
+    uint32_t NodeCount() const { return header->nodeCount; }
+    const MeshCacheNode& Node(uint32_t i) const { return reinterpret_cast<const MeshCacheNode*>(file.Data() + header->nodeOffset)[i]; }
+    const MeshLod* Lods() const { return reinterpret_cast<const MeshLod*>(file.Data() + header->lodOffset); }
+    const Meshlet* Meshlets() const { return reinterpret_cast<const Meshlet*>(file.Data() + header->meshletOffset); }
+    const Vertex* Vertices() const { return reinterpret_cast<const Vertex*>(file.Data() + header->vertexOffset); }
+    const unsigned int* Indices() const { return reinterpret_cast<const unsigned int*>(file.Data() + header->indexOffset); }
+    string TextureType(uint32_t i) const { return cacheString(textures()[i].typeOffset, textures()[i].typeLength); }
+    string TexturePath(uint32_t i) const { return cacheString(textures()[i].pathOffset, textures()[i].pathLength); }
+
+private:
+    MappedFile file;
+    const MeshCacheHeader* header = nullptr;
+
+    bool fail()
+    {
+        header = nullptr;
+        file.Close();
+        return false;
+    }
+    bool sectionFits(uint64_t offset, uint64_t count, uint64_t elementSize) const
+    {
+        return offset % MESH_CACHE_ALIGNMENT == 0 && offset <= file.Size() && count <= (file.Size() - offset) / elementSize;
+    }
+    const MeshCacheTexture* textures() const { return reinterpret_cast<const MeshCacheTexture*>(file.Data() + header->textureOffset); }
+    string cacheString(uint32_t offset, uint32_t length) const
+    {
+        const char* strings = reinterpret_cast<const char*>(file.Data() + header->stringOffset);
+        return string(strings + offset, length);
+    }
+};
+
+// serializes the meshes of a model. The file is written next to the final path and renamed
+// into place so an interrupted write never leaves a truncated cache behind.
+inline bool WriteMeshCache(const string& cachePath, uint64_t sourceHash, uint32_t importFlags, uint32_t optionFlags, const vector<Mesh>& meshes,
+                           const SceneGraph& sceneGraph)
+{
+    vector<MeshCacheRecord> records;
+    vector<MeshLod> lods;
+    vector<Meshlet> meshlets;
+    vector<MeshCacheTexture> textureRefs;
+    string strings;
+    uint64_t vertexCount = 0, indexCount = 0;
+    for (const Mesh& mesh : meshes)
+    {
+        MeshCacheRecord record;
+        record.firstVertex = static_cast<uint32_t>(vertexCount);
+        record.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+        record.firstIndex = static_cast<uint32_t>(indexCount);
+        record.indexCount = static_cast<uint32_t>(mesh.indices.size());
+        record.firstTexture = static_cast<uint32_t>(textureRefs.size());
+        record.textureCount = static_cast<uint32_t>(mesh.textures.size());
+        record.bounds = mesh.bounds;
+        record.node = mesh.node;
+        record.firstLod = static_cast<uint32_t>(lods.size());
+        record.lodCount = static_cast<uint32_t>(mesh.lods.size());
+        lods.insert(lods.end(), mesh.lods.begin(), mesh.lods.end());
+        record.firstMeshlet = static_cast<uint32_t>(meshlets.size());
+        record.meshletCount = static_cast<uint32_t>(mesh.meshlets.size());
+        meshlets.insert(meshlets.end(), mesh.meshlets.begin(), mesh.meshlets.end());
+        records.push_back(record);
+        vertexCount += mesh.vertices.size();
+        indexCount += mesh.indices.size();
+
+        for (const Texture& texture : mesh.textures)
+        {
+            MeshCacheTexture ref;
+            ref.typeOffset = static_cast<uint32_t>(strings.size());
+            ref.typeLength = static_cast<uint32_t>(texture.type.size());
+            strings += texture.type;
+            ref.pathOffset = static_cast<uint32_t>(strings.size());
+            ref.pathLength = static_cast<uint32_t>(texture.path.size());
+            strings += texture.path;
+            textureRefs.push_back(ref);
+        }
+    }
+
+    vector<MeshCacheNode> nodes(sceneGraph.Size());
+    for (uint32_t i = 0; i < nodes.size(); i++)
+    {
+        nodes[i].parent = sceneGraph.Parent(i);
+        memcpy(nodes[i].local, &sceneGraph.Local(i)[0][0], sizeof(nodes[i].local));
+    }
+
+    auto align = [](uint64_t offset) { return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(MESH_CACHE_ALIGNMENT - 1); };
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.importFlags = importFlags;
+    header.optionFlags = optionFlags;
+    header.vertexStride = sizeof(Vertex);
+    header.meshCount = static_cast<uint32_t>(records.size());
+    header.nodeCount = static_cast<uint32_t>(nodes.size());
+    header.lodCount = static_cast<uint32_t>(lods.size());
+    header.meshletCount = static_cast<uint32_t>(meshlets.size());
+    header.textureCount = static_cast<uint32_t>(textureRefs.size());
+    header.stringSize = static_cast<uint32_t>(strings.size());
+    header.vertexCount = vertexCount;
+    header.indexCount = indexCount;
+    header.meshOffset = align(sizeof(MeshCacheHeader));
+    header.nodeOffset = align(header.meshOffset + records.size() * sizeof(MeshCacheRecord));
+    header.lodOffset = align(header.nodeOffset + nodes.size() * sizeof(MeshCacheNode));
+    header.meshletOffset = align(header.lodOffset + lods.size() * sizeof(MeshLod));
+    header.textureOffset = align(header.meshletOffset + meshlets.size() * sizeof(Meshlet));
+    header.stringOffset = align(header.textureOffset + textureRefs.size() * sizeof(MeshCacheTexture));
+    header.vertexOffset = align(header.stringOffset + strings.size());
+    header.indexOffset = align(header.vertexOffset + vertexCount * sizeof(Vertex));
+    header.fileSize = header.indexOffset + indexCount * sizeof(unsigned int);
+
+    string tempPath = cachePath + ".tmp";
+    {
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        if (!out)
+        {
+            remove(tempPath.c_str());
+            return false;
+        }
+        auto writeAt = [&out](uint64_t offset, const void* data, size_t size)
+        {
+            static const char zeros[MESH_CACHE_ALIGNMENT] = {};
+            uint64_t position = static_cast<uint64_t>(out.tellp());
+            out.write(zeros, static_cast<streamsize>(offset - position)); // padding up to the section start
+            if (size > 0)
+                out.write(static_cast<const char*>(data), static_cast<streamsize>(size));
+        };
+        writeAt(0, &header, sizeof(header));
+        writeAt(header.meshOffset, records.data(), records.size() * sizeof(MeshCacheRecord));
+        writeAt(header.nodeOffset, nodes.data(), nodes.size() * sizeof(MeshCacheNode));
+        writeAt(header.lodOffset, lods.data(), lods.size() * sizeof(MeshLod));
+        writeAt(header.meshletOffset, meshlets.data(), meshlets.size() * sizeof(Meshlet));
+        writeAt(header.textureOffset, textureRefs.data(), textureRefs.size() * sizeof(MeshCacheTexture));
+        writeAt(header.stringOffset, strings.data(), strings.size());
+        writeAt(header.vertexOffset, nullptr, 0);
+        for (const Mesh& mesh : meshes)
+            writeAt(static_cast<uint64_t>(out.tellp()), mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        writeAt(header.indexOffset, nullptr, 0);
+        for (const Mesh& mesh : meshes)
+            writeAt(static_cast<uint64_t>(out.tellp()), mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+        out.close();
+        if (!out)
+        {
+            remove(tempPath.c_str());
+            return false;
+        }
+    }
+    remove(cachePath.c_str());
+    if (rename(tempPath.c_str(), cachePath.c_str()) != 0)
+    {
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+#endif
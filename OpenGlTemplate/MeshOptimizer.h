@@ -0,0 +1,345 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm/glm.hpp>
+
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// Index/vertex reordering for faster rendering of static meshes, run once at import:
+// 1. OptimizeVertexCache: Forsyth's linear-speed vertex cache optimization, fewer vertex shader invocations
+// 2. OptimizeOverdraw:    splits the result into clusters and draws outward facing clusters first, less overdraw
+// 3. OptimizeVertexFetch: stores vertices in the order they are first used, better memory locality
+// All of them work on plain vectors and never touch OpenGL, so they can run on the import worker threads.
+
+// post-transform cache simulated by AnalyzeVertexCache, a FIFO the size of what current GPUs effectively reuse
+const unsigned int VERTEX_CACHE_ANALYZE_SIZE = 16;
+// LRU cache modelled by the Forsyth optimizer
+const unsigned int VERTEX_CACHE_OPTIMIZE_SIZE = 32;
+
+struct VertexCacheStatistics {
+    // average cache miss ratio: transformed vertices per triangle (0.5 is the ideal for large regular meshes, 3 the worst)
+    float acmr = 0.0f;
+    // average transform to vertex ratio: transformed vertices per referenced vertex (1 is ideal)
+    float atvr = 0.0f;
+};
+
+// simulates a FIFO post-transform cache over the triangle list
+inline VertexCacheStatistics AnalyzeVertexCache(const vector<unsigned int>& indices, size_t vertexCount, unsigned int cacheSize = VERTEX_CACHE_ANALYZE_SIZE)
+{
+    VertexCacheStatistics statistics;
+    if (indices.empty())
+        return statistics;
+
+    // a vertex is in the cache if it was inserted less than cacheSize insertions ago
+    vector<size_t> insertedAt(vertexCount, 0);
+    vector<bool> referenced(vertexCount, false);
+    size_t insertions = 0, uniqueVertices = 0;
+    for (unsigned int index : indices)
+    {
+        if (!referenced[index])
+        {
+            referenced[index] = true;
+            uniqueVertices++;
+        }
+        if (insertedAt[index] == 0 || insertions - insertedAt[index] >= cacheSize)
+            insertedAt[index] = ++insertions; // miss: the vertex shader runs
+    }
+    statistics.acmr = float(insertions) / float(indices.size() / 3);
+    statistics.atvr = float(insertions) / float(uniqueVertices);
+    return statistics;
+}
+
+// scoring from Tom Forsyth, "Linear-Speed Vertex Cache Optimisation"
+inline float ForsythVertexScore(int cachePosition, unsigned int liveTriangles)
+{
+    if (liveTriangles == 0)
+        return -1.0f; // nothing left to draw with this vertex
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        if (cachePosition < 3)
+            score = 0.75f; // used by the last triangle, deliberately not the best choice so strips don't get stuck
+        else
+            score = powf(1.0f - float(cachePosition - 3) / float(VERTEX_CACHE_OPTIMIZE_SIZE - 3), 1.5f);
+    }
+    // favour vertices with few triangles left, so they leave the working set soon
+    return score + 2.0f / sqrtf(float(liveTriangles));
+}
+
+// reorders triangles so consecutive triangles share vertices
+inline void OptimizeVertexCache(vector<unsigned int>& indices, size_t vertexCount)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // adjacency: the triangles using each vertex
+    vector<unsigned int> liveTriangles(vertexCount, 0);
+    for (unsigned int index : indices)
+        liveTriangles[index]++;
+    vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+    vector<unsigned int> adjacency(indices.size());
+    vector<unsigned int> cursor(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[cursor[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+
+    vector<int> cachePosition(vertexCount, -1);
+    vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        vertexScore[v] = ForsythVertexScore(-1, liveTriangles[v]);
+
+    vector<bool> emitted(triangleCount, false);
+    vector<unsigned int> result;
+    result.reserve(indices.size());
+    vector<unsigned int> cache, nextCache;
+    cache.reserve(VERTEX_CACHE_OPTIMIZE_SIZE + 3);
+    nextCache.reserve(VERTEX_CACHE_OPTIMIZE_SIZE + 3);
+    size_t scanCursor = 0;
+
+    int bestTriangle = -1;
+    for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+    {
+        if (bestTriangle < 0)
+        {
+            // the cache had nothing useful (start, or a disconnected piece), take the next triangle in input order
+            while (emitted[scanCursor])
+                scanCursor++;
+            bestTriangle = static_cast<int>(scanCursor);
+        }
+
+        const unsigned int* triangle = &indices[bestTriangle * 3];
+        result.insert(result.end(), triangle, triangle + 3);
+        emitted[bestTriangle] = true;
+
+        // move the triangle's vertices to the front of the LRU cache and drop the triangle from their adjacency
+        nextCache.assign(triangle, triangle + 3);
+        for (unsigned int v : cache)
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                nextCache.push_back(v);
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = triangle[k];
+            unsigned int* begin = &adjacency[adjacencyOffset[v]];
+            unsigned int* end = begin + liveTriangles[v];
+            unsigned int* found = find(begin, end, static_cast<unsigned int>(bestTriangle));
+            if (found != end)
+            {
+                *found = *(end - 1);
+                liveTriangles[v]--;
+            }
+        }
+
+        // rescore everything that was in the cache, including the vertices that just fell out
+        for (size_t i = 0; i < nextCache.size(); i++)
+        {
+            unsigned int v = nextCache[i];
+            cachePosition[v] = i < VERTEX_CACHE_OPTIMIZE_SIZE ? static_cast<int>(i) : -1;
+            vertexScore[v] = ForsythVertexScore(cachePosition[v], liveTriangles[v]);
+        }
+
+        // the next triangle is picked among the ones touching the cache
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : nextCache)
+        {
+            const unsigned int* begin = &adjacency[adjacencyOffset[v]];
+            for (unsigned int i = 0; i < liveTriangles[v]; i++)
+            {
+                unsigned int t = begin[i];
+                float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = static_cast<int>(t);
+                }
+            }
+        }
+
+        if (nextCache.size() > VERTEX_CACHE_OPTIMIZE_SIZE)
+            nextCache.resize(VERTEX_CACHE_OPTIMIZE_SIZE);
+        swap(cache, nextCache);
+    }
+    indices.swap(result);
+}
+
+// Reorders the clusters of a cache optimized index list to reduce overdraw, after Sander, Nehab and Barczak,
+// "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw". Clusters are cut where the cache would be
+// cold anyway, or where a fresh start costs at most `threshold` times the current ACMR, then sorted so that
+// clusters facing away from the mesh centre (likely occluders) are drawn first.
+inline void OptimizeOverdraw(vector<unsigned int>& indices, const vector<Vertex>& vertices, float threshold = 1.05f)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+    float targetAcmr = AnalyzeVertexCache(indices, vertices.size()).acmr * threshold;
+
+    // cluster boundaries, simulating the same FIFO cache as AnalyzeVertexCache
+    vector<size_t> clusterStart;
+    vector<size_t> insertedAt(vertices.size(), 0);
+    size_t insertions = 0;
+    size_t softStart = 0, softMisses = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        unsigned int misses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int index = indices[t * 3 + k];
+            if (insertedAt[index] == 0 || insertions - insertedAt[index] >= VERTEX_CACHE_ANALYZE_SIZE)
+            {
+                insertedAt[index] = ++insertions;
+                misses++;
+            }
+        }
+        // hard boundary: the triangle shares nothing with the cache, the optimizer jumped elsewhere
+        if (t == 0 || misses == 3)
+        {
+            clusterStart.push_back(t);
+            softStart = t;
+            softMisses = 0;
+            // every cluster has to stand on its own once they are shuffled, so start over with only this triangle cached
+            insertions += VERTEX_CACHE_ANALYZE_SIZE;
+            for (int k = 0; k < 3; k++)
+                insertedAt[indices[t * 3 + k]] = ++insertions;
+        }
+        softMisses += misses;
+        // soft boundary: the cluster so far is as cache friendly as the whole mesh, restarting after it is cheap
+        size_t softTriangles = t + 1 - softStart;
+        if (softTriangles >= 16 && float(softMisses) / float(softTriangles) <= targetAcmr && t + 1 < triangleCount)
+        {
+            clusterStart.push_back(t + 1);
+            softStart = t + 1;
+            softMisses = 0;
+            insertions += VERTEX_CACHE_ANALYZE_SIZE; // flush
+        }
+    }
+    clusterStart.erase(unique(clusterStart.begin(), clusterStart.end()), clusterStart.end());
+    if (clusterStart.size() < 2)
+        return;
+    clusterStart.push_back(triangleCount);
+
+    // mesh centroid, area weighted
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const glm::vec3& a = vertices[indices[t * 3]].Position;
+        const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+        const glm::vec3& c = vertices[indices[t * 3 + 2]].Position;
+        float area = glm::length(glm::cross(b - a, c - a));
+        meshCentroid += (a + b + c) * (area / 3.0f);
+        meshArea += area;
+    }
+    meshCentroid /= max(meshArea, 1e-20f);
+
+    // sort key per cluster: how much its average normal points away from the mesh centre
+    size_t clusterCount = clusterStart.size() - 1;
+    vector<float> clusterKey(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+        {
+            const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+            float faceArea = glm::length(faceNormal);
+            centroid += (p0 + p1 + p2) * (faceArea / 3.0f);
+            normal += faceNormal;
+            area += faceArea;
+        }
+        centroid /= max(area, 1e-20f);
+        float normalLength = glm::length(normal);
+        clusterKey[c] = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+    }
+
+    vector<size_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+        order[c] = c;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return clusterKey[a] > clusterKey[b]; });
+
+    vector<unsigned int> result;
+    result.reserve(indices.size());
+    for (size_t c : order)
+        result.insert(result.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+    indices.swap(result);
+}
+
+// orders vertices by the attributes a mesh draws with. The bone slots are never filled and take no part.
+inline int CompareVertexAttributes(const Vertex& a, const Vertex& b)
+{
+    const float* first[] = { &a.Position.x, &a.Normal.x, &a.TexCoords.x, &a.Tangent.x, &a.Bitangent.x };
+    const float* second[] = { &b.Position.x, &b.Normal.x, &b.TexCoords.x, &b.Tangent.x, &b.Bitangent.x };
+    const int components[] = { 3, 3, 2, 3, 3 };
+    for (int attribute = 0; attribute < 5; attribute++)
+        for (int c = 0; c < components[attribute]; c++)
+            if (first[attribute][c] != second[attribute][c])
+                return first[attribute][c] < second[attribute][c] ? -1 : 1;
+    return 0;
+}
+
+// for every vertex, the first vertex with the same attributes.
+// Welding is owned by the import: aiProcess_JoinIdenticalVertices in MODEL_IMPORT_FLAGS merges the copies an OBJ
+// comes with, and the vertex buffers keep that result. The passes that work on connectivity, SimplifyMesh and
+// BuildMeshlets, call this only so they do not depend on it: on welded input every vertex maps to itself and they
+// see exactly the imported topology. Nothing else welds.
+inline vector<unsigned int> IdenticalVertexRemap(const vector<Vertex>& vertices)
+{
+    vector<unsigned int> order(vertices.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+    auto less = [&vertices](unsigned int a, unsigned int b)
+    {
+        int compare = CompareVertexAttributes(vertices[a], vertices[b]);
+        return compare != 0 ? compare < 0 : a < b;
+    };
+    sort(order.begin(), order.end(), less);
+    vector<unsigned int> remap(vertices.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        bool copy = i > 0 && CompareVertexAttributes(vertices[order[i]], vertices[order[i - 1]]) == 0;
+        remap[order[i]] = copy ? remap[order[i - 1]] : order[i];
+    }
+    return remap;
+}
+
+// stores the vertices in the order the index buffer first references them and drops unreferenced ones
+inline void OptimizeVertexFetch(vector<Vertex>& vertices, vector<unsigned int>& indices)
+{
+    const unsigned int unused = ~0u;
+    vector<unsigned int> remap(vertices.size(), unused);
+    vector<Vertex> result;
+    result.reserve(vertices.size());
+    for (unsigned int& index : indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = static_cast<unsigned int>(result.size());
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(result);
+}
+
+// runs the whole pipeline, returns the cache statistics before and after
+inline void OptimizeMesh(vector<Vertex>& vertices, vector<unsigned int>& indices, VertexCacheStatistics& before, VertexCacheStatistics& after)
+{
+    before = AnalyzeVertexCache(indices, vertices.size());
+    OptimizeVertexCache(indices, vertices.size());
+    OptimizeOverdraw(indices, vertices);
+    OptimizeVertexFetch(vertices, indices);
+    after = AnalyzeVertexCache(indices, vertices.size());
+}
+#endif
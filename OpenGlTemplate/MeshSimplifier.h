@@ -0,0 +1,256 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm/glm.hpp>
+
+#include "mesh.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Level of detail generation by edge collapse with quadric error metrics (Garland and Heckbert, "Surface
+// Simplification Using Quadric Error Metrics"). A vertex is always collapsed onto one of its neighbours, never moved,
+// so every level indexes the original vertex buffer and the levels differ in their index lists only.
+// Vertices on open borders are never removed: in index space UV and normal seams are borders too, so this keeps
+// attribute discontinuities intact at the price of simplifying heavily seamed meshes less. CPU only, import time.
+
+// triangle count of each level relative to the previous one
+const float LOD_REDUCTION = 0.5f;
+// a level that removes less than this share of the previous level's triangles is not worth keeping
+const float LOD_MIN_REDUCTION = 0.2f;
+// collapses that turn a triangle's normal by more than about 80 degrees are rejected
+const double LOD_MAX_NORMAL_DEVIATION = 0.2;
+
+// symmetric 4x4 matrix of summed squared plane distances, plus the area weight that went into it
+struct Quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    double weight;
+};
+
+inline Quadric PlaneQuadric(const glm::dvec3& normal, double distance, double weight)
+{
+    double a = normal.x, b = normal.y, c = normal.z, d = distance;
+    Quadric q = { a * a * weight, a * b * weight, a * c * weight, a * d * weight, b * b * weight, b * c * weight,
+                  b * d * weight, c * c * weight, c * d * weight, d * d * weight, weight };
+    return q;
+}
+
+inline void AddQuadric(Quadric& q, const Quadric& other)
+{
+    q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad; q.b2 += other.b2;
+    q.bc += other.bc; q.bd += other.bd; q.c2 += other.c2; q.cd += other.cd; q.d2 += other.d2;
+    q.weight += other.weight;
+}
+
+// weighted sum of squared distances from the point to the quadric's planes
+inline double QuadricError(const Quadric& q, const glm::vec3& point)
+{
+    double x = point.x, y = point.y, z = point.z;
+    double error = q.a2 * x * x + 2 * q.ab * x * y + 2 * q.ac * x * z + 2 * q.ad * x +
+                   q.b2 * y * y + 2 * q.bc * y * z + 2 * q.bd * y + q.c2 * z * z + 2 * q.cd * z + q.d2;
+    return error > 0.0 ? error : 0.0;
+}
+
+// reduces the triangle list to about targetIndexCount indices, or as far as it goes. error receives the largest
+// distance (in the mesh's own units) a collapse moved the surface by: the root mean square distance of the moved
+// vertex to the planes it had accumulated.
+inline vector<unsigned int> SimplifyMesh(const vector<Vertex>& vertices, const vector<unsigned int>& indices, size_t targetIndexCount, float& error)
+{
+    error = 0.0f;
+    size_t triangleCount = indices.size() / 3;
+    // connectivity over identical vertices (see IdenticalVertexRemap), the result indexes the first of them, which
+    // draws the same
+    vector<unsigned int> remap = IdenticalVertexRemap(vertices);
+    vector<unsigned int> triangles(triangleCount * 3);
+    for (size_t i = 0; i < triangles.size(); i++)
+        triangles[i] = remap[indices[i]];
+    vector<uint8_t> triangleAlive(triangleCount, 1);
+    size_t aliveTriangles = triangleCount;
+
+    // triangles around every vertex, collapses move triangles from the removed vertex to the kept one
+    vector<vector<uint32_t>> vertexTriangles(vertices.size());
+    for (uint32_t t = 0; t < triangleCount; t++)
+        for (int corner = 0; corner < 3; corner++)
+            vertexTriangles[triangles[t * 3 + corner]].push_back(t);
+
+    // an edge used by one triangle is a border, by more than two non-manifold: their vertices stay
+    unordered_map<uint64_t, int> edgeUse;
+    edgeUse.reserve(triangleCount * 3);
+    auto edgeKey = [](unsigned int a, unsigned int b) { return (uint64_t(min(a, b)) << 32) | max(a, b); };
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int corner = 0; corner < 3; corner++)
+            edgeUse[edgeKey(triangles[t * 3 + corner], triangles[t * 3 + (corner + 1) % 3])]++;
+    vector<uint8_t> locked(vertices.size(), 0);
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        for (int corner = 0; corner < 3; corner++)
+        {
+            unsigned int a = triangles[t * 3 + corner], b = triangles[t * 3 + (corner + 1) % 3];
+            if (edgeUse[edgeKey(a, b)] != 2)
+                locked[a] = locked[b] = 1;
+        }
+    }
+
+    // every triangle's plane goes into the quadrics of its corners, weighted by its area
+    Quadric zero = {};
+    vector<Quadric> quadrics(vertices.size(), zero);
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        glm::dvec3 a = glm::dvec3(vertices[triangles[t * 3]].Position);
+        glm::dvec3 b = glm::dvec3(vertices[triangles[t * 3 + 1]].Position);
+        glm::dvec3 c = glm::dvec3(vertices[triangles[t * 3 + 2]].Position);
+        glm::dvec3 normal = glm::cross(b - a, c - a);
+        double length = glm::length(normal);
+        if (length <= 0.0)
+            continue;
+        normal /= length;
+        Quadric plane = PlaneQuadric(normal, -glm::dot(normal, a), length * 0.5);
+        for (int corner = 0; corner < 3; corner++)
+            AddQuadric(quadrics[triangles[t * 3 + corner]], plane);
+    }
+
+    // candidate collapses ordered by cost. Entries go stale when either vertex changes, the stamps tell.
+    struct Collapse {
+        double cost;
+        uint32_t from, to;
+        uint32_t fromStamp, toStamp;
+        bool operator>(const Collapse& other) const { return cost > other.cost; }
+    };
+    vector<Collapse> heap;
+    vector<uint32_t> stamps(vertices.size(), 0);
+    vector<uint8_t> removed(vertices.size(), 0);
+    auto pushCollapse = [&](uint32_t from, uint32_t to)
+    {
+        if (locked[from])
+            return;
+        Quadric merged = quadrics[from];
+        AddQuadric(merged, quadrics[to]);
+        Collapse collapse = { QuadricError(merged, vertices[to].Position), from, to, stamps[from], stamps[to] };
+        heap.push_back(collapse);
+        push_heap(heap.begin(), heap.end(), greater<Collapse>());
+    };
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        for (int corner = 0; corner < 3; corner++)
+        {
+            uint32_t a = triangles[t * 3 + corner], b = triangles[t * 3 + (corner + 1) % 3];
+            pushCollapse(a, b);
+            pushCollapse(b, a);
+        }
+    }
+
+    auto triangleNormal = [&](uint32_t t, uint32_t moved, const glm::vec3& position)
+    {
+        glm::vec3 corners[3];
+        for (int corner = 0; corner < 3; corner++)
+        {
+            uint32_t v = triangles[t * 3 + corner];
+            corners[corner] = v == moved ? position : vertices[v].Position;
+        }
+        return glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+    };
+
+    double largestError = 0.0;
+    while (aliveTriangles * 3 > targetIndexCount && !heap.empty())
+    {
+        pop_heap(heap.begin(), heap.end(), greater<Collapse>());
+        Collapse collapse = heap.back();
+        heap.pop_back();
+        uint32_t u = collapse.from, v = collapse.to;
+        if (removed[u] || removed[v] || stamps[u] != collapse.fromStamp || stamps[v] != collapse.toStamp)
+            continue;
+
+        // reject collapses that fold a remaining triangle over
+        bool flips = false;
+        for (uint32_t t : vertexTriangles[u])
+        {
+            if (!triangleAlive[t] || triangles[t * 3] == v || triangles[t * 3 + 1] == v || triangles[t * 3 + 2] == v)
+                continue;
+            glm::vec3 before = triangleNormal(t, u, vertices[u].Position);
+            glm::vec3 after = triangleNormal(t, u, vertices[v].Position);
+            if (glm::dot(before, after) <= LOD_MAX_NORMAL_DEVIATION * glm::length(before) * glm::length(after))
+            {
+                flips = true;
+                break;
+            }
+        }
+        if (flips)
+            continue;
+
+        for (uint32_t t : vertexTriangles[u])
+        {
+            if (!triangleAlive[t])
+                continue;
+            unsigned int* corners = &triangles[t * 3];
+            if (corners[0] == v || corners[1] == v || corners[2] == v)
+            {
+                triangleAlive[t] = 0; // the edge's triangles collapse to lines
+                aliveTriangles--;
+                continue;
+            }
+            for (int corner = 0; corner < 3; corner++)
+                if (corners[corner] == u)
+                    corners[corner] = v;
+            vertexTriangles[v].push_back(t);
+        }
+        removed[u] = 1;
+        vector<uint32_t>().swap(vertexTriangles[u]);
+        AddQuadric(quadrics[v], quadrics[u]);
+        stamps[v]++;
+        if (quadrics[v].weight > 0.0)
+            largestError = max(largestError, collapse.cost / quadrics[v].weight);
+
+        // v's quadric changed: requeue the collapses along its remaining edges
+        vector<uint32_t>& around = vertexTriangles[v];
+        around.erase(remove_if(around.begin(), around.end(), [&](uint32_t t) { return !triangleAlive[t]; }), around.end());
+        for (uint32_t t : around)
+        {
+            for (int corner = 0; corner < 3; corner++)
+            {
+                uint32_t neighbour = triangles[t * 3 + corner];
+                if (neighbour == v)
+                    continue;
+                pushCollapse(v, neighbour);
+                pushCollapse(neighbour, v);
+            }
+        }
+    }
+
+    vector<unsigned int> result;
+    result.reserve(aliveTriangles * 3);
+    for (size_t t = 0; t < triangleCount; t++)
+        if (triangleAlive[t])
+            result.insert(result.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+    error = static_cast<float>(sqrt(largestError));
+    return result;
+}
+
+// appends up to maxLods - 1 simplified levels to indices, each about LOD_REDUCTION times the size of the one before,
+// and describes all levels (the original first) in lods. Stops early once a level hardly removes anything.
+inline void GenerateLods(const vector<Vertex>& vertices, vector<unsigned int>& indices, int maxLods, bool optimize, vector<MeshLod>& lods)
+{
+    MeshLod full = { 0, static_cast<unsigned int>(indices.size()), 0.0f };
+    lods.assign(1, full);
+    size_t fullCount = indices.size();
+    for (int level = 1; level < maxLods; level++)
+    {
+        size_t target = static_cast<size_t>(fullCount / 3 * pow(LOD_REDUCTION, level)) * 3;
+        float error;
+        // always from the full mesh, so each level's error is measured against the original surface
+        vector<unsigned int> simplified = SimplifyMesh(vertices, vector<unsigned int>(indices.begin(), indices.begin() + fullCount), target, error);
+        if (simplified.empty() || simplified.size() > lods.back().indexCount * (1.0f - LOD_MIN_REDUCTION))
+            break;
+        if (optimize)
+            OptimizeVertexCache(simplified, vertices.size());
+        MeshLod lod = { static_cast<unsigned int>(indices.size()), static_cast<unsigned int>(simplified.size()), max(error, lods.back().error) };
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        lods.push_back(lod);
+    }
+}
+#endif
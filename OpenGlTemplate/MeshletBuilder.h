@@ -0,0 +1,187 @@
+#ifndef MESHLET_BUILDER_H
+#define MESHLET_BUILDER_H
+
+#include <glm/glm/glm.hpp>
+
+#include "Bounds.h"
+#include "mesh.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// Splits a mesh into meshlets: clusters of connected triangles that share few vertices, each with a bounding sphere
+// and a cone around its triangle normals, so RenderQueue can skip clusters outside the frustum or facing away from
+// the camera. A meshlet's triangles are made contiguous in the index list and keep their relative order, which the
+// vertex cache optimization chose, so a meshlet is just a range of the mesh's index buffer. CPU only, import time.
+
+// limits per meshlet, the sizes mesh shading hardware works with: small enough to cull finely, large enough that
+// the per-meshlet draw stays cheap
+const size_t MESHLET_MAX_VERTICES = 64;
+const size_t MESHLET_MAX_TRIANGLES = 124;
+
+// bounding sphere and normal cone of a meshlet's triangles
+inline void ComputeMeshletBounds(const vector<Vertex>& vertices, const unsigned int* indices, size_t indexCount,
+                                 const vector<unsigned int>& meshletVertices, Meshlet& meshlet)
+{
+    vector<glm::vec3> positions;
+    positions.reserve(meshletVertices.size());
+    for (unsigned int vertex : meshletVertices)
+        positions.push_back(vertices[vertex].Position);
+    Bounds bounds = ComputeBounds(positions.data(), positions.size());
+    meshlet.center = bounds.center;
+    meshlet.radius = bounds.radius;
+
+    // the cone axis is the mean of the unit normals, degenerate triangles are never seen and do not count
+    vector<glm::vec3> normals;
+    glm::vec3 axis(0.0f);
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        const glm::vec3& a = vertices[indices[i]].Position;
+        glm::vec3 normal = glm::cross(vertices[indices[i + 1]].Position - a, vertices[indices[i + 2]].Position - a);
+        float length = glm::length(normal);
+        if (length <= 0.0f)
+            continue;
+        normals.push_back(normal / length);
+        axis += normals.back();
+    }
+    meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = 1.0f;
+    float axisLength = glm::length(axis);
+    if (axisLength < 1e-6f)
+        return;
+    axis /= axisLength;
+    float minimumDot = 1.0f;
+    for (const glm::vec3& normal : normals)
+        minimumDot = min(minimumDot, glm::dot(normal, axis));
+    // a cone wider than a hemisphere faces the camera from everywhere, the cutoff of 1 keeps it
+    if (minimumDot <= 0.0f)
+        return;
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = sqrt(1.0f - minimumDot * minimumDot);
+}
+
+// clusters the first indexCount indices (level 0) into meshlets of at most MESHLET_MAX_VERTICES vertices and
+// MESHLET_MAX_TRIANGLES triangles and reorders them so each meshlet's triangles are consecutive. A meshlet grows by
+// the triangle on its frontier (not yet emitted, touching one of its vertices) that adds the fewest new vertices,
+// the one nearest its centre on ties, and is closed when the limits are reached or no frontier triangle fits.
+// Adjacency is built over identical vertices (see IdenticalVertexRemap): without shared vertices every triangle
+// would add three.
+inline void BuildMeshlets(const vector<Vertex>& vertices, vector<unsigned int>& indices, size_t indexCount, vector<Meshlet>& meshlets)
+{
+    meshlets.clear();
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0)
+        return;
+    vector<unsigned int> remap = IdenticalVertexRemap(vertices);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        indices[i] = remap[indices[i]];
+
+    // the triangles around each vertex
+    vector<unsigned int> adjacencyOffsets(vertices.size() + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        adjacencyOffsets[indices[i] + 1]++;
+    for (size_t v = 0; v < vertices.size(); v++)
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    vector<unsigned int> adjacency(triangleCount * 3);
+    vector<unsigned int> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+        adjacency[cursor[indices[i]]++] = static_cast<unsigned int>(i / 3);
+
+    vector<glm::vec3> centroids(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        centroids[t] = (vertices[indices[t * 3]].Position + vertices[indices[t * 3 + 1]].Position + vertices[indices[t * 3 + 2]].Position) / 3.0f;
+
+    vector<bool> emitted(triangleCount, false);
+    vector<bool> inMeshlet(vertices.size(), false);
+    vector<bool> inFrontier(triangleCount, false);
+    vector<unsigned int> meshletVertices, meshletTriangles, frontier;
+    vector<unsigned int> reordered;
+    reordered.reserve(triangleCount * 3);
+    size_t seed = 0;
+    while (true)
+    {
+        while (seed < triangleCount && emitted[seed])
+            seed++;
+        if (seed == triangleCount)
+            break;
+
+        meshletVertices.clear();
+        meshletTriangles.clear();
+        frontier.clear();
+        glm::vec3 centroidSum(0.0f);
+        size_t next = seed;
+        while (next != triangleCount)
+        {
+            emitted[next] = true;
+            meshletTriangles.push_back(static_cast<unsigned int>(next));
+            centroidSum += centroids[next];
+            for (int corner = 0; corner < 3; corner++)
+            {
+                unsigned int vertex = indices[next * 3 + corner];
+                if (inMeshlet[vertex])
+                    continue;
+                inMeshlet[vertex] = true;
+                meshletVertices.push_back(vertex);
+                for (unsigned int i = adjacencyOffsets[vertex]; i < adjacencyOffsets[vertex + 1]; i++)
+                {
+                    unsigned int triangle = adjacency[i];
+                    if (!emitted[triangle] && !inFrontier[triangle])
+                    {
+                        inFrontier[triangle] = true;
+                        frontier.push_back(triangle);
+                    }
+                }
+            }
+            if (meshletTriangles.size() == MESHLET_MAX_TRIANGLES)
+                break;
+
+            glm::vec3 center = centroidSum / static_cast<float>(meshletTriangles.size());
+            next = triangleCount;
+            int bestNewVertices = 4;
+            float bestDistance = 0.0f;
+            for (size_t i = 0; i < frontier.size();)
+            {
+                unsigned int triangle = frontier[i];
+                // emitted ones leave the frontier, swapped with the last entry
+                if (emitted[triangle])
+                {
+                    inFrontier[triangle] = false;
+                    frontier[i] = frontier.back();
+                    frontier.pop_back();
+                    continue;
+                }
+                i++;
+                int newVertices = !inMeshlet[indices[triangle * 3]] + !inMeshlet[indices[triangle * 3 + 1]] + !inMeshlet[indices[triangle * 3 + 2]];
+                if (meshletVertices.size() + newVertices > MESHLET_MAX_VERTICES)
+                    continue;
+                glm::vec3 offset = centroids[triangle] - center;
+                float distance = glm::dot(offset, offset);
+                if (newVertices < bestNewVertices || (newVertices == bestNewVertices && distance < bestDistance))
+                {
+                    next = triangle;
+                    bestNewVertices = newVertices;
+                    bestDistance = distance;
+                }
+            }
+        }
+
+        sort(meshletTriangles.begin(), meshletTriangles.end());
+        Meshlet meshlet;
+        meshlet.firstIndex = static_cast<unsigned int>(reordered.size());
+        meshlet.indexCount = static_cast<unsigned int>(meshletTriangles.size() * 3);
+        for (unsigned int triangle : meshletTriangles)
+            reordered.insert(reordered.end(), indices.begin() + triangle * 3, indices.begin() + triangle * 3 + 3);
+        ComputeMeshletBounds(vertices, reordered.data() + meshlet.firstIndex, meshlet.indexCount, meshletVertices, meshlet);
+        meshlets.push_back(meshlet);
+        for (unsigned int vertex : meshletVertices)
+            inMeshlet[vertex] = false;
+        for (unsigned int triangle : frontier)
+            inFrontier[triangle] = false;
+    }
+    copy(reordered.begin(), reordered.end(), indices.begin());
+}
+#endif
@@ -0,0 +1,117 @@
+#ifndef MULTI_DRAW_H
+#define MULTI_DRAW_H
+
+#include <glad/glad.h>
+
+#include "GLCaps.h"
+#include "mesh.h"
+
+#include <vector>
+
+using namespace std;
+
+// the layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint  baseVertex;
+    GLuint baseInstance;
+};
+
+// A list of index ranges inside one VAO and index buffer, of which any consecutive run is drawn with a single call:
+// glMultiDrawElementsIndirect from a buffer of commands when the context has it, glMultiDrawElementsBaseVertex
+// with the same commands as client arrays otherwise.
+class MultiDrawList
+{
+public:
+    MultiDrawList() {}
+    ~MultiDrawList()
+    {
+        if (buffer != 0)
+            glDeleteBuffers(1, &buffer);
+    }
+    MultiDrawList(const MultiDrawList&) = delete;
+    MultiDrawList& operator=(const MultiDrawList&) = delete;
+
+    // appends a draw of the range, which must already be relative to the shared buffers. Returns its command index.
+    size_t Add(const DrawRange& range)
+    {
+        DrawElementsIndirectCommand command = { range.indexCount, 1, range.firstIndex, range.baseVertex, 0 };
+        commands.push_back(command);
+        return commands.size() - 1;
+    }
+
+    void Clear()
+    {
+        commands.clear();
+    }
+
+    // prepares the commands for drawing, call after the last Add() with the index type of the shared index buffer
+    void Upload(GLenum type)
+    {
+        indexType = type;
+        if (GLCaps::Get().multiDrawIndirect)
+        {
+            if (buffer == 0)
+                glGenBuffers(1, &buffer);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            return;
+        }
+
+        counts.resize(commands.size());
+        offsets.resize(commands.size());
+        baseVertices.resize(commands.size());
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            counts[i] = static_cast<GLsizei>(commands[i].count);
+            offsets[i] = (void*)(commands[i].firstIndex * IndexSize(indexType));
+            baseVertices[i] = commands[i].baseVertex;
+        }
+    }
+
+    // draws count commands starting at first, with the VAO of the shared buffers bound
+    void Draw(size_t first, size_t count) const
+    {
+        if (count == 0)
+            return;
+        if (buffer != 0)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+            GLCaps::Get().MultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void*)(first * sizeof(DrawElementsIndirectCommand)),
+                                                    static_cast<GLsizei>(count), 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            return;
+        }
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data() + first, indexType, offsets.data() + first,
+                                      static_cast<GLsizei>(count), baseVertices.data() + first);
+    }
+
+    // draws instanceCount copies of each command. Neither 3.3 nor the stored commands (instanceCount 1) cover that,
+    // so this issues one instanced draw per command.
+    void DrawInstanced(size_t first, size_t count, GLsizei instanceCount) const
+    {
+        for (size_t i = first; i < first + count; i++)
+        {
+            const DrawElementsIndirectCommand& command = commands[i];
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, indexType, (void*)(command.firstIndex * IndexSize(indexType)),
+                                              instanceCount, command.baseVertex);
+        }
+    }
+
+    size_t Size() const { return commands.size(); }
+    // whether Draw() goes through an indirect buffer
+    bool Indirect() const { return buffer != 0; }
+
+private:
+    vector<DrawElementsIndirectCommand> commands;
+    GLenum indexType = GL_UNSIGNED_INT;
+    unsigned int buffer = 0;
+    // client side copy of the commands for glMultiDrawElementsBaseVertex
+    vector<GLsizei> counts;
+    vector<const void*> offsets;
+    vector<GLint> baseVertices;
+};
+#endif
@@ -0,0 +1,137 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include "GLCaps.h"
+#include "Hash.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+// Linked program binaries from glGetProgramBinary, one file per program under PROGRAM_CACHE_DIRECTORY.
+// A file is named after its key, the hash of the program's sources and of the driver that linked it, so edited
+// shaders and driver updates simply miss the cache and get compiled from source again.
+const char PROGRAM_CACHE_DIRECTORY[] = "ShaderCache";
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+const char PROGRAM_CACHE_MAGIC[4] = { 'B', 'P', 'P', 'C' };
+
+struct ProgramCacheHeader {
+    char     magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t binaryLength;
+};
+
+inline uint64_t ProgramCacheKey(const vector<string>& sources)
+{
+    uint64_t hash = HashBytes(&PROGRAM_CACHE_VERSION, sizeof(PROGRAM_CACHE_VERSION));
+    for (const string& source : sources)
+    {
+        uint64_t length = source.size(); // keeps "ab"+"c" apart from "a"+"bc"
+        hash = HashBytes(&length, sizeof(length), hash);
+        hash = HashBytes(source.data(), source.size(), hash);
+    }
+    const GLenum driverStrings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (GLenum name : driverStrings)
+    {
+        const char* value = reinterpret_cast<const char*>(glGetString(name));
+        if (value)
+            hash = HashBytes(value, strlen(value) + 1, hash);
+    }
+    return hash;
+}
+
+inline string ProgramCachePath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return string(PROGRAM_CACHE_DIRECTORY) + "/" + name;
+}
+
+// has to be set before linking, or the driver may not keep a retrievable binary around
+inline void MarkProgramRetrievable(GLuint program)
+{
+    if (GLCaps::Get().programBinary)
+        GLCaps::Get().ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+// hands the cached binary to the driver, returns false if there is none. Whether the driver accepted it shows in the
+// link status, which is left to the caller: querying it here would wait for the driver to finish.
+// a rejected binary can leave the program in a failed state, callers should start over with a new program.
+inline bool LoadProgramBinary(GLuint program, uint64_t key)
+{
+    if (!GLCaps::Get().programBinary)
+        return false;
+    ifstream file(ProgramCachePath(key), ios::binary);
+    if (!file)
+        return false;
+    ProgramCacheHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, PROGRAM_CACHE_MAGIC, 4) != 0 ||
+        header.version != PROGRAM_CACHE_VERSION || header.key != key || header.binaryLength == 0)
+        return false;
+    vector<char> binary(header.binaryLength);
+    if (!file.read(binary.data(), binary.size()))
+        return false;
+
+    GLCaps::Get().ProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+    return true;
+}
+
+// stores the binary of a successfully linked program, returns false if the driver or the file system refused
+inline bool SaveProgramBinary(GLuint program, uint64_t key)
+{
+    if (!GLCaps::Get().programBinary)
+        return false;
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+    vector<char> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    GLCaps::Get().GetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+        return false;
+
+#ifdef _WIN32
+    _mkdir(PROGRAM_CACHE_DIRECTORY);
+#else
+    mkdir(PROGRAM_CACHE_DIRECTORY, 0755);
+#endif
+    ProgramCacheHeader header;
+    memcpy(header.magic, PROGRAM_CACHE_MAGIC, 4);
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.binaryFormat = format;
+    header.binaryLength = static_cast<uint32_t>(written);
+
+    // written under a temporary name first so a crash never leaves a truncated binary behind
+    string path = ProgramCachePath(key);
+    string tempPath = path + ".tmp";
+    {
+        ofstream file(tempPath, ios::binary | ios::trunc);
+        if (!file.write(reinterpret_cast<const char*>(&header), sizeof(header)) || !file.write(binary.data(), written))
+        {
+            file.close();
+            remove(tempPath.c_str());
+            return false;
+        }
+    }
+    remove(path.c_str());
+    return rename(tempPath.c_str(), path.c_str()) == 0;
+}
+#endif
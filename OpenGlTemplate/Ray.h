@@ -0,0 +1,84 @@
+#ifndef RAY_H
+#define RAY_H
+
+#include <glm/glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// a half line, origin + t * direction for t >= 0. direction need not be normalized: t is then measured in units of
+// its length, which is what lets a ray be transformed into model space without changing the hit distances.
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+inline Ray TransformRay(const Ray& ray, const glm::mat4& transform)
+{
+    Ray transformed;
+    transformed.origin = glm::vec3(transform * glm::vec4(ray.origin, 1.0f));
+    transformed.direction = glm::vec3(transform * glm::vec4(ray.direction, 0.0f));
+    return transformed;
+}
+
+// the world space ray through a point on the screen (pixels, origin top left) of a viewport of the given size,
+// starting on the near plane
+inline Ray ScreenRay(float x, float y, float width, float height, const glm::mat4& inverseViewProjection)
+{
+    float ndcX = 2.0f * x / width - 1.0f;
+    float ndcY = 1.0f - 2.0f * y / height;
+    glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    Ray ray;
+    ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+    ray.direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - ray.origin);
+    return ray;
+}
+
+// 1 / direction per axis for the slab test, a zero component becomes a huge value of the same sign
+inline glm::vec3 InverseDirection(const glm::vec3& direction)
+{
+    glm::vec3 inverse;
+    for (int i = 0; i < 3; i++)
+        inverse[i] = 1.0f / (direction[i] != 0.0f ? direction[i] : copysign(1e-30f, direction[i]));
+    return inverse;
+}
+
+// slab test, distance receives where the ray enters the box (0 if it starts inside)
+inline bool IntersectRayBox(const Ray& ray, const glm::vec3& inverseDirection, const glm::vec3& min, const glm::vec3& max,
+                            float maxDistance, float& distance)
+{
+    glm::vec3 t0 = (min - ray.origin) * inverseDirection;
+    glm::vec3 t1 = (max - ray.origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+    distance = enter;
+    return enter <= exit;
+}
+
+// Moeller-Trumbore, hits from both sides
+inline bool IntersectRayTriangle(const Ray& ray, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& distance)
+{
+    const float epsilon = 1e-8f;
+    glm::vec3 edge1 = b - a, edge2 = c - a;
+    glm::vec3 p = glm::cross(ray.direction, edge2);
+    float determinant = glm::dot(edge1, p);
+    if (fabs(determinant) < epsilon)
+        return false; // parallel to the triangle
+    float inverseDeterminant = 1.0f / determinant;
+    glm::vec3 s = ray.origin - a;
+    float u = glm::dot(s, p) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(ray.direction, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+    distance = glm::dot(edge2, q) * inverseDeterminant;
+    return distance >= 0.0f;
+}
+#endif
@@ -0,0 +1,390 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "Bounds.h"
+#include "BVH.h"
+#include "Frustum.h"
+#include "GLCaps.h"
+#include "GLState.h"
+#include "InstanceBuffer.h"
+#include "mesh.h"
+#include "MultiDraw.h"
+#include "RingBuffer.h"
+#include "Shader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+// how far (in pixels) a level of detail may move the surface on screen before a more detailed one is drawn
+const float LOD_MAX_PIXEL_ERROR = 1.0f;
+
+// passes are executed separately, each with its own fixed function state set up by the caller
+enum RenderPass {
+    RENDER_PASS_OPAQUE = 0,
+    RENDER_PASS_OUTLINE = 1
+};
+
+// sort key layout, most significant first: pass | program | texture set | VAO | depth.
+// sorting by it groups draws by program, then by material, then by geometry, and front to back inside those.
+const int RENDER_KEY_PASS_SHIFT = 60;         // 4 bits
+const int RENDER_KEY_PROGRAM_SHIFT = 48;      // 12 bits
+const int RENDER_KEY_TEXTURE_SET_SHIFT = 32;  // 16 bits
+const int RENDER_KEY_VERTEX_ARRAY_SHIFT = 20; // 12 bits
+const uint64_t RENDER_KEY_DEPTH_MAX = (1u << 20) - 1;
+
+// small process-wide id for a list of textures, equal lists get equal ids so they sort next to each other
+inline uint32_t TextureSetId(const vector<Texture>& textures)
+{
+    static map<vector<unsigned int>, uint32_t> ids;
+    vector<unsigned int> key;
+    key.reserve(textures.size());
+    for (const Texture& texture : textures)
+        key.push_back(texture.id);
+    map<vector<unsigned int>, uint32_t>::iterator found = ids.find(key);
+    if (found != ids.end())
+        return found->second;
+    uint32_t id = static_cast<uint32_t>(ids.size());
+    ids.emplace(key, id);
+    return id;
+}
+
+// one recorded draw: either a mesh, a run of commands in a multi-draw list (both optionally instanced), or the
+// meshlets of a mesh that survived culling
+struct RenderItem {
+    Shader* shader;
+    const vector<Texture>* textures;
+    const vector<string>* samplers;
+    unsigned int vertexArray;
+    const Mesh* mesh;
+    const MultiDrawList* drawList;
+    size_t firstCommand;
+    size_t commandCount;
+    glm::mat4 model;
+    const InstanceBuffer* instances;
+    GLintptr transformOffset; // of model in the ring buffer, -1 if the ring was full
+    int lod;                  // level of detail of mesh, the draw list's commands are for one level already
+    GLenum indexType;         // of the meshlet ranges, firstCommand and commandCount then index the frame's meshlet ranges
+};
+
+// Draws are recorded during the frame, sorted by a 64 bit key with a radix sort and then submitted pass by pass,
+// so consecutive draws share as much state as possible no matter in which order models recorded them.
+// Model matrices are written to the ring buffer as they are submitted and bound as the Transforms block per draw,
+// which costs one glBindBufferRange instead of a uniform upload. Flush the ring between Sort() and Execute().
+// Meshlets are culled one by one as they are submitted, the kept ones go into the ring as indirect draw commands.
+class RenderQueue
+{
+public:
+    explicit RenderQueue(RingBuffer& ring)
+        : ring(ring)
+    {
+    }
+    RenderQueue(const RenderQueue&) = delete;
+    RenderQueue& operator=(const RenderQueue&) = delete;
+
+    // drops last frame's draws (keeping the memory) and sets the eye position depth is measured from and the frustum
+    // Visible() and CullInstances() test against. call after RingBuffer::BeginFrame()
+    void Begin(const glm::vec3& eye, float farPlane, const Frustum& viewFrustum = Frustum())
+    {
+        items.clear();
+        keys.clear();
+        viewPosition = eye;
+        depthScale = farPlane > 0.0f ? 1.0f / farPlane : 0.0f;
+        frustum = viewFrustum;
+        culling = CullStatistics();
+        meshletRanges.clear();
+        meshletCommandsOffset = -1;
+        lastTransformOffset = -1;
+        boundTransformOffset = -1;
+    }
+
+    // with instances the mesh is drawn once per transform in the buffer, instanced shaders apply model before it
+    void SubmitMesh(RenderPass pass, Shader& shader, const Mesh& mesh, uint32_t textureSet, const glm::mat4& model, const glm::vec3& center,
+                    const InstanceBuffer* instances = nullptr, int lod = 0)
+    {
+        RenderItem item = { &shader, &mesh.textures, &mesh.samplers, mesh.VertexArray(), &mesh, nullptr, 0, 0, model, instances, -1, lod, 0 };
+        push(item, pass, textureSet, center);
+    }
+
+    // draws the meshlets of the full mesh (level 0) that are inside the frustum with a single multi-draw. Culling
+    // happens in node space, the frustum and eye are moved there with model, so under non-uniform scale the cone test
+    // is approximate. Meshlets facing away from the camera are dropped only while GL_CULL_FACE is enabled through
+    // GLState at submission (with the default back face, counter-clockwise culling): without it their back faces show.
+    void SubmitMeshlets(RenderPass pass, Shader& shader, const Mesh& mesh, uint32_t textureSet, const glm::mat4& model, const glm::vec3& center)
+    {
+        size_t first = meshletRanges.size();
+        glm::vec3 eye = glm::vec3(glm::inverse(model) * glm::vec4(viewPosition, 1.0f));
+        bool cullBackFacing = GLState::Get().IsEnabled(GL_CULL_FACE);
+        unsigned int kept = mesh.CullMeshlets(frustum.Transformed(model), eye, cullBackFacing, meshletRanges);
+        if (pass == RENDER_PASS_OPAQUE)
+        {
+            culling.meshletsVisible += kept;
+            culling.meshletsCulled += static_cast<unsigned int>(mesh.meshlets.size()) - kept;
+        }
+        if (kept == 0)
+            return;
+        RenderItem item = { &shader, &mesh.textures, &mesh.samplers, mesh.VertexArray(), nullptr, nullptr, first, meshletRanges.size() - first,
+                            model, nullptr, -1, 0, mesh.BufferIndexType() };
+        push(item, pass, textureSet, center);
+    }
+
+    void SubmitMultiDraw(RenderPass pass, Shader& shader, const vector<Texture>& textures, const vector<string>& samplers, uint32_t textureSet,
+                         unsigned int vertexArray, const MultiDrawList& drawList, size_t firstCommand, size_t commandCount,
+                         const glm::mat4& model, const glm::vec3& center, const InstanceBuffer* instances = nullptr)
+    {
+        RenderItem item = { &shader, &textures, &samplers, vertexArray, nullptr, &drawList, firstCommand, commandCount, model, instances, -1, 0, 0 };
+        push(item, pass, textureSet, center);
+    }
+
+    // the projection level of detail selection assumes: pixels of the viewport's height and the vertical field of view
+    void SetLodProjection(float viewportHeight, float fieldOfViewY)
+    {
+        lodScale = viewportHeight / (2.0f * tan(fieldOfViewY * 0.5f));
+    }
+
+    // the largest world space error that stays within LOD_MAX_PIXEL_ERROR anywhere on world space bounds.
+    // 0 (full detail) until SetLodProjection() was called.
+    float MaxLodError(const Bounds& worldBounds) const
+    {
+        if (lodScale <= 0.0f)
+            return 0.0f;
+        float distance = glm::length(worldBounds.center - viewPosition) - worldBounds.radius;
+        if (distance <= 0.0f)
+            return 0.0f;
+        return LOD_MAX_PIXEL_ERROR * distance / lodScale;
+    }
+
+    // whether world space bounds intersect the frustum, counted in Culling() for the opaque pass
+    bool Visible(const Bounds& worldBounds, RenderPass pass)
+    {
+        bool visible = frustum.Intersects(worldBounds);
+        count(pass, visible ? 1 : 0, visible ? 0 : 1);
+        return visible;
+    }
+
+    // copies the transforms that place bounds (in model space) at least partly inside the frustum to visible.
+    // only the bounding sphere is tested, the box test costs more than it saves for whole instances.
+    void CullInstances(const Bounds& bounds, const vector<glm::mat4>& transforms, vector<glm::mat4>& visible, RenderPass pass)
+    {
+        visible.clear();
+        if (IsEmpty(bounds))
+            return;
+        for (const glm::mat4& transform : transforms)
+        {
+            glm::vec3 center = glm::vec3(transform * glm::vec4(bounds.center, 1.0f));
+            if (frustum.IntersectsSphere(center, bounds.radius * MaxScale(transform)))
+                visible.push_back(transform);
+        }
+        count(pass, static_cast<unsigned int>(visible.size()), static_cast<unsigned int>(transforms.size() - visible.size()));
+    }
+
+    // the same for transforms with a BVH built over their world space bounds, which skips whole groups of invisible
+    // instances at once. visible keeps the order of transforms.
+    void CullInstances(const BVH& bvh, const vector<glm::mat4>& transforms, vector<glm::mat4>& visible, RenderPass pass)
+    {
+        visibleIndices.clear();
+        bvh.Query(frustum, visibleIndices);
+        sort(visibleIndices.begin(), visibleIndices.end());
+        visible.clear();
+        for (uint32_t index : visibleIndices)
+            visible.push_back(transforms[index]);
+        count(pass, static_cast<unsigned int>(visible.size()), static_cast<unsigned int>(transforms.size() - visible.size()));
+    }
+
+    // the primitives of a BVH built over model space bounds that intersect the frustum with the model placed by model.
+    // the frustum is moved into model space instead of the bounds into world space, so the tree needs no refit when
+    // only model changes.
+    void CullPrimitives(const BVH& bvh, const glm::mat4& model, vector<uint32_t>& visible, RenderPass pass)
+    {
+        visible.clear();
+        bvh.Query(frustum.Transformed(model), visible);
+        count(pass, static_cast<unsigned int>(visible.size()), static_cast<unsigned int>(bvh.PrimitiveCount() - visible.size()));
+    }
+
+    // orders the recorded draws by key and writes the meshlet commands, call once after the last Submit
+    void Sort()
+    {
+        writeMeshletCommands();
+        // least significant digit first, 8 bits per pass. Digits every key shares (unused key bits) are skipped.
+        scratch.resize(keys.size());
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t counts[256] = { 0 };
+            for (const SortEntry& entry : keys)
+                counts[(entry.key >> shift) & 0xFF]++;
+            if (keys.empty() || counts[(keys[0].key >> shift) & 0xFF] == keys.size())
+                continue;
+            size_t offset = 0;
+            for (size_t& count : counts)
+            {
+                size_t digitCount = count;
+                count = offset;
+                offset += digitCount;
+            }
+            for (const SortEntry& entry : keys)
+                scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+            keys.swap(scratch);
+        }
+    }
+
+    // submits the sorted draws of one pass
+    void Execute(RenderPass pass)
+    {
+        Shader* currentShader = nullptr;
+        // another queue may have pointed the Transforms block elsewhere since the last pass
+        boundTransformOffset = -1;
+        for (const SortEntry& entry : keys)
+        {
+            if ((entry.key >> RENDER_KEY_PASS_SHIFT) != static_cast<uint64_t>(pass))
+                continue;
+            const RenderItem& item = items[entry.item];
+            if (item.transformOffset < 0)
+                continue; // the ring ran out of room for its transform
+            if (item.shader != currentShader)
+            {
+                currentShader = item.shader;
+                currentShader->use();
+            }
+            if (item.transformOffset != boundTransformOffset)
+            {
+                boundTransformOffset = item.transformOffset;
+                glBindBufferRange(GL_UNIFORM_BUFFER, TRANSFORMS_BLOCK_BINDING, ring.Buffer(), item.transformOffset, sizeof(glm::mat4));
+            }
+            BindTextures(*currentShader, *item.textures, *item.samplers);
+            GLState::Get().BindVertexArray(item.vertexArray);
+            if (item.instances)
+            {
+                item.instances->Attach(item.vertexArray);
+                if (item.mesh)
+                    item.mesh->DrawElementsInstanced(item.instances->Count(), item.lod);
+                else
+                    item.drawList->DrawInstanced(item.firstCommand, item.commandCount, item.instances->Count());
+            }
+            else if (item.mesh)
+                item.mesh->DrawElements(item.lod);
+            else if (item.drawList)
+                item.drawList->Draw(item.firstCommand, item.commandCount);
+            else
+                drawMeshlets(item);
+        }
+    }
+
+    size_t Size() const { return items.size(); }
+    // meshes, instances and meshlets kept and dropped since Begin(). Other passes test the same objects again, only
+    // the opaque pass is counted.
+    const CullStatistics& Culling() const { return culling; }
+
+private:
+    struct SortEntry {
+        uint64_t key;
+        uint32_t item;
+    };
+    vector<RenderItem> items;
+    vector<SortEntry> keys;
+    vector<SortEntry> scratch;
+    glm::vec3 viewPosition = glm::vec3(0.0f);
+    float depthScale = 0.0f;
+    Frustum frustum;
+    float lodScale = 0.0f; // pixels per unit of world space size at distance 1
+    CullStatistics culling;
+    vector<uint32_t> visibleIndices;
+    // the kept meshlets of the frame, as ranges of the buffers of their meshes
+    vector<DrawRange> meshletRanges;
+    GLintptr meshletCommandsOffset = -1; // of meshletRanges as indirect commands in the ring, -1 to draw from client arrays
+    vector<GLsizei> meshletCounts;
+    vector<const void*> meshletOffsets;
+    vector<GLint> meshletBaseVertices;
+    RingBuffer& ring;
+    glm::mat4 lastTransform;
+    GLintptr lastTransformOffset = -1;  // draws submitted with the same matrix share its copy in the ring
+    GLintptr boundTransformOffset = -1; // what TRANSFORMS_BLOCK_BINDING points at during Execute()
+
+    // one command per kept meshlet range. Without glMultiDrawElementsIndirect, or if the ring is full, drawMeshlets()
+    // falls back to glMultiDrawElementsBaseVertex with the ranges as client arrays.
+    void writeMeshletCommands()
+    {
+        if (meshletRanges.empty() || !GLCaps::Get().multiDrawIndirect)
+            return;
+        void* data = ring.Allocate(meshletRanges.size() * sizeof(DrawElementsIndirectCommand), sizeof(GLuint), meshletCommandsOffset);
+        if (!data)
+        {
+            meshletCommandsOffset = -1;
+            return;
+        }
+        DrawElementsIndirectCommand* commands = static_cast<DrawElementsIndirectCommand*>(data);
+        for (size_t i = 0; i < meshletRanges.size(); i++)
+        {
+            DrawElementsIndirectCommand command = { meshletRanges[i].indexCount, 1, meshletRanges[i].firstIndex, meshletRanges[i].baseVertex, 0 };
+            commands[i] = command;
+        }
+    }
+
+    void drawMeshlets(const RenderItem& item)
+    {
+        if (meshletCommandsOffset >= 0)
+        {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring.Buffer());
+            GLCaps::Get().MultiDrawElementsIndirect(GL_TRIANGLES, item.indexType,
+                                                    (void*)(meshletCommandsOffset + item.firstCommand * sizeof(DrawElementsIndirectCommand)),
+                                                    static_cast<GLsizei>(item.commandCount), 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            return;
+        }
+        meshletCounts.clear();
+        meshletOffsets.clear();
+        meshletBaseVertices.clear();
+        for (size_t i = item.firstCommand; i < item.firstCommand + item.commandCount; i++)
+        {
+            meshletCounts.push_back(static_cast<GLsizei>(meshletRanges[i].indexCount));
+            meshletOffsets.push_back((void*)(meshletRanges[i].firstIndex * IndexSize(item.indexType)));
+            meshletBaseVertices.push_back(meshletRanges[i].baseVertex);
+        }
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, meshletCounts.data(), item.indexType, meshletOffsets.data(),
+                                      static_cast<GLsizei>(item.commandCount), meshletBaseVertices.data());
+    }
+
+    void count(RenderPass pass, unsigned int visible, unsigned int culled)
+    {
+        if (pass != RENDER_PASS_OPAQUE)
+            return;
+        culling.visible += visible;
+        culling.culled += culled;
+    }
+
+    void push(RenderItem item, RenderPass pass, uint32_t textureSet, const glm::vec3& center)
+    {
+        if (lastTransformOffset < 0 || item.model != lastTransform)
+        {
+            void* data = ring.Allocate(sizeof(glm::mat4), ring.UniformAlignment(), lastTransformOffset);
+            if (data)
+            {
+                memcpy(data, &item.model, sizeof(glm::mat4));
+                lastTransform = item.model;
+            }
+            else
+                lastTransformOffset = -1;
+        }
+        item.transformOffset = lastTransformOffset;
+
+        float depth = glm::length(center - viewPosition) * depthScale;
+        uint64_t quantizedDepth = static_cast<uint64_t>(min(max(depth, 0.0f), 1.0f) * RENDER_KEY_DEPTH_MAX);
+        SortEntry entry;
+        entry.key = (static_cast<uint64_t>(pass) << RENDER_KEY_PASS_SHIFT) |
+                    (static_cast<uint64_t>(item.shader->ID & 0xFFF) << RENDER_KEY_PROGRAM_SHIFT) |
+                    (static_cast<uint64_t>(textureSet & 0xFFFF) << RENDER_KEY_TEXTURE_SET_SHIFT) |
+                    (static_cast<uint64_t>(item.vertexArray & 0xFFF) << RENDER_KEY_VERTEX_ARRAY_SHIFT) |
+                    quantizedDepth;
+        entry.item = static_cast<uint32_t>(items.size());
+        items.push_back(item);
+        keys.push_back(entry);
+    }
+};
+#endif
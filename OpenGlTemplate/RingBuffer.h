@@ -0,0 +1,143 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <glad/glad.h>
+
+#include "GLCaps.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// frames the CPU may run ahead of the GPU, each writes its own section of the ring
+const int RING_BUFFER_FRAMES = 3;
+
+// One buffer for data that changes every frame (transforms, instance data, uniform blocks), split into
+// RING_BUFFER_FRAMES sections used in turn. A fence per section makes the CPU wait only if the GPU is still reading the
+// section it is about to overwrite, which never happens unless it runs more than two frames behind.
+// With buffer storage the ring is mapped persistently and written in place; on plain 3.3 the writes go to a staging
+// copy and are uploaded with glBufferSubData by Flush(). The buffer can be bound to any target. GL thread only.
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t bytesPerFrame)
+    {
+        frameSize = align(bytesPerFrame, 256);
+        GLsizeiptr totalSize = static_cast<GLsizeiptr>(frameSize * RING_BUFFER_FRAMES);
+        GLint uniformOffsetAlignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformOffsetAlignment);
+        uniformAlignment = static_cast<size_t>(uniformOffsetAlignment);
+
+        // the copy target leaves the bindings draws depend on (array, element, uniform) alone
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        if (GLCaps::Get().bufferStorage)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            GLCaps::Get().BufferStorage(GL_COPY_WRITE_BUFFER, totalSize, NULL, flags);
+            mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalSize, flags));
+        }
+        if (!mapped)
+        {
+            glBufferData(GL_COPY_WRITE_BUFFER, totalSize, NULL, GL_STREAM_DRAW);
+            staging.resize(frameSize);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    ~RingBuffer()
+    {
+        for (GLsync& fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+        }
+        if (mapped)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // moves on to the next section, waiting for the GPU to finish the frame that used it last
+    void BeginFrame()
+    {
+        section = (section + 1) % RING_BUFFER_FRAMES;
+        GLsync& fence = fences[section];
+        if (fence)
+        {
+            GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+            while (glClientWaitSync(fence, waitFlags, 1000000) == GL_TIMEOUT_EXPIRED)
+                waitFlags = 0; // only flush once
+            glDeleteSync(fence);
+            fence = 0;
+        }
+        used = 0;
+        flushed = 0;
+    }
+
+    // reserves size bytes of this frame's section and returns where to write them, offset receives their position in
+    // Buffer(). Returns null if the section is full: bytesPerFrame was too small for the frame.
+    void* Allocate(size_t size, size_t alignment, GLintptr& offset)
+    {
+        size_t start = align(used, alignment);
+        if (start + size > frameSize)
+        {
+            if (!overflowReported)
+                cout << "ERROR::RING_BUFFER:: frame needs more than " << frameSize << " bytes of streamed data" << endl;
+            overflowReported = true;
+            return nullptr;
+        }
+        used = start + size;
+        offset = static_cast<GLintptr>(section * frameSize + start);
+        return mapped ? mapped + offset : staging.data() + start;
+    }
+
+    // makes what was written since the last Flush() visible to the GPU, call before drawing with it
+    void Flush()
+    {
+        if (!mapped && used > flushed)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(section * frameSize + flushed), used - flushed, staging.data() + flushed);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        flushed = used;
+    }
+
+    // call after the frame's last draw that reads from the ring
+    void EndFrame()
+    {
+        Flush();
+        fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    unsigned int Buffer() const { return buffer; }
+    // offsets bound with glBindBufferRange(GL_UNIFORM_BUFFER, ...) have to be multiples of this
+    size_t UniformAlignment() const { return uniformAlignment; }
+    // whether the ring is written in place through a persistent mapping
+    bool Persistent() const { return mapped != nullptr; }
+
+private:
+    unsigned int buffer = 0;
+    size_t frameSize = 0;
+    size_t uniformAlignment = 256;
+    unsigned char* mapped = nullptr;
+    vector<unsigned char> staging; // this frame's section, when not mapped
+    GLsync fences[RING_BUFFER_FRAMES] = {};
+    int section = RING_BUFFER_FRAMES - 1;
+    size_t used = 0, flushed = 0;
+    bool overflowReported = false;
+
+    static size_t align(size_t value, size_t alignment)
+    {
+        return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+    }
+};
+#endif
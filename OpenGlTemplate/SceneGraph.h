@@ -0,0 +1,101 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+const uint32_t SCENE_NO_PARENT = ~0u;
+
+// A transform hierarchy stored as parallel arrays (structure of arrays) in depth first preorder: every node comes
+// after its parent and a node's descendants are the subtreeSize - 1 nodes right behind it. World matrices are
+// cached; changing a local matrix only marks the node, and Update() recomputes the marked subtrees in one linear
+// sweep each, parents before children, without looking at the rest of the tree.
+class SceneGraph
+{
+public:
+    // appends a node, parent must be SCENE_NO_PARENT or a node whose subtree is still open (the last node added or one
+    // of its ancestors), which is what a recursive walk of a tree produces. Returns the node's index.
+    uint32_t AddNode(uint32_t parent, const glm::mat4& local)
+    {
+        uint32_t index = static_cast<uint32_t>(parents.size());
+        if (parent != SCENE_NO_PARENT && (parent >= index || parent + subtreeSizes[parent] != index))
+        {
+            cout << "ERROR::SCENE_GRAPH:: node " << index << " added out of preorder, attached to the root instead" << endl;
+            parent = SCENE_NO_PARENT;
+        }
+        parents.push_back(parent);
+        locals.push_back(local);
+        worlds.push_back(parent == SCENE_NO_PARENT ? local : worlds[parent] * local);
+        subtreeSizes.push_back(1);
+        dirty.push_back(0);
+        for (uint32_t ancestor = parent; ancestor != SCENE_NO_PARENT; ancestor = parents[ancestor])
+            subtreeSizes[ancestor]++;
+        return index;
+    }
+
+    void Clear()
+    {
+        parents.clear();
+        locals.clear();
+        worlds.clear();
+        subtreeSizes.clear();
+        dirty.clear();
+        dirtyNodes.clear();
+    }
+
+    void SetLocal(uint32_t node, const glm::mat4& local)
+    {
+        locals[node] = local;
+        if (!dirty[node])
+        {
+            dirty[node] = 1;
+            dirtyNodes.push_back(node);
+        }
+    }
+
+    // recomputes the world matrices below every node changed since the last call, returns how many were recomputed
+    size_t Update()
+    {
+        if (dirtyNodes.empty())
+            return 0;
+        // in preorder a subtree that starts inside one already swept is covered by it
+        sort(dirtyNodes.begin(), dirtyNodes.end());
+        size_t updated = 0;
+        uint32_t sweptEnd = 0;
+        for (uint32_t root : dirtyNodes)
+        {
+            dirty[root] = 0;
+            if (root < sweptEnd)
+                continue;
+            uint32_t end = root + subtreeSizes[root];
+            for (uint32_t i = root; i < end; i++)
+                worlds[i] = parents[i] == SCENE_NO_PARENT ? locals[i] : worlds[parents[i]] * locals[i];
+            updated += end - root;
+            sweptEnd = end;
+        }
+        dirtyNodes.clear();
+        return updated;
+    }
+
+    size_t Size() const { return parents.size(); }
+    uint32_t Parent(uint32_t node) const { return parents[node]; }
+    uint32_t SubtreeSize(uint32_t node) const { return subtreeSizes[node]; }
+    const glm::mat4& Local(uint32_t node) const { return locals[node]; }
+    // node to model space, as of the last Update()
+    const glm::mat4& World(uint32_t node) const { return worlds[node]; }
+
+private:
+    vector<uint32_t> parents;
+    vector<glm::mat4> locals;
+    vector<glm::mat4> worlds;
+    vector<uint32_t> subtreeSizes;
+    vector<uint8_t> dirty; // already in dirtyNodes
+    vector<uint32_t> dirtyNodes;
+};
+#endif
@@ -0,0 +1,158 @@
+#ifndef SCREEN_OUTLINE_H
+#define SCREEN_OUTLINE_H
+
+#include <glad/glad.h>
+#include <glm/glm/glm.hpp>
+
+#include "GLState.h"
+#include "Shader.h"
+#include "ShaderManager.h"
+
+#include <iostream>
+
+using namespace std;
+
+// how the selection outline is drawn
+enum OutlineMode {
+    // the model drawn a second time, scaled up, where the stencil is not set
+    OUTLINE_GEOMETRY,
+    // an edge pass over the stencil mask of the first draw, its cost depends on the screen size only
+    OUTLINE_SCREEN_SPACE
+};
+
+// Outline from the stencil buffer instead of the geometry. The scene is rendered into an offscreen target whose
+// depth-stencil renderbuffer is shared with a mask target: a fullscreen pass with the stencil test turns the
+// stencil bits into a mask texture, and a second one copies the scene to the screen, painting the pixels that lie
+// within Width pixels of the mask. GL thread only.
+class ScreenOutline
+{
+public:
+    glm::vec4 Color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    int Width = 4;
+
+    explicit ScreenOutline(ShaderManager& shaders)
+        : maskShader(shaders.Load("fullscreen.vs", "outline_mask.frag")),
+          compositeShader(shaders.Load("fullscreen.vs", "outline_composite.frag"))
+    {
+        // the fullscreen triangle is generated from gl_VertexID, but core profile still wants a VAO bound
+        glGenVertexArrays(1, &emptyVAO);
+    }
+    ~ScreenOutline()
+    {
+        deleteTargets();
+        GLState::Get().ForgetVertexArray(emptyVAO);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+    ScreenOutline(const ScreenOutline&) = delete;
+    ScreenOutline& operator=(const ScreenOutline&) = delete;
+
+    // redirects rendering into the offscreen scene target, (re)created to match the framebuffer size
+    void BeginScene(int width, int height)
+    {
+        if (width != targetWidth || height != targetHeight)
+            createTargets(width, height);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    }
+
+    // turns the pixels with stencil value 1 into the outline and presents the scene on the default framebuffer.
+    // leaves the depth test enabled and stencil writes on, like the frame starts with.
+    void Resolve()
+    {
+        GLState& glState = GLState::Get();
+        glState.Disable(GL_DEPTH_TEST);
+        glState.BindVertexArray(emptyVAO);
+
+        // 1. mask: 1 wherever the stencil test passes
+        glBindFramebuffer(GL_FRAMEBUFFER, maskFBO);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glState.StencilFunc(GL_EQUAL, 1, 0xFF);
+        glState.StencilMask(0x00);
+        maskShader.use();
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        // 2. scene plus outline onto the screen
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glState.Disable(GL_STENCIL_TEST);
+        compositeShader.use();
+        compositeShader.setInt("sceneColor", 0);
+        compositeShader.setInt("outlineMask", 1);
+        compositeShader.setVec4("outlineColor", Color);
+        compositeShader.setInt("outlineWidth", Width);
+        glState.BindTexture(0, sceneColor);
+        glState.BindTexture(1, maskTexture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glState.Enable(GL_STENCIL_TEST);
+        glState.StencilMask(0xFF);
+        glState.Enable(GL_DEPTH_TEST);
+    }
+
+private:
+    Shader& maskShader;
+    Shader& compositeShader;
+    unsigned int emptyVAO = 0;
+    unsigned int sceneFBO = 0, maskFBO = 0;
+    unsigned int sceneColor = 0, maskTexture = 0, depthStencil = 0;
+    int targetWidth = 0, targetHeight = 0;
+
+    // a texture sampled one texel per pixel, no filtering or mipmaps
+    static unsigned int createTarget(GLint internalFormat, GLenum format, int width, int height)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        GLState::Get().BindTexture(texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void createTargets(int width, int height)
+    {
+        deleteTargets();
+        targetWidth = width;
+        targetHeight = height;
+
+        sceneColor = createTarget(GL_RGBA8, GL_RGBA, width, height);
+        maskTexture = createTarget(GL_R8, GL_RED, width, height);
+        glGenRenderbuffers(1, &depthStencil);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        // both targets use the same depth-stencil, so the mask pass tests against the stencil the scene wrote
+        glGenFramebuffers(1, &sceneFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sceneColor, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::FRAMEBUFFER:: outline scene target is not complete" << endl;
+
+        glGenFramebuffers(1, &maskFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, maskFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, maskTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencil);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::FRAMEBUFFER:: outline mask target is not complete" << endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void deleteTargets()
+    {
+        if (sceneFBO == 0)
+            return;
+        glDeleteFramebuffers(1, &sceneFBO);
+        glDeleteFramebuffers(1, &maskFBO);
+        glDeleteRenderbuffers(1, &depthStencil);
+        GLState::Get().ForgetTexture(sceneColor);
+        GLState::Get().ForgetTexture(maskTexture);
+        glDeleteTextures(1, &sceneColor);
+        glDeleteTextures(1, &maskTexture);
+        sceneFBO = maskFBO = depthStencil = sceneColor = maskTexture = 0;
+    }
+};
+#endif
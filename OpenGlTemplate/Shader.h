@@ -3,10 +3,22 @@
 
 #include <glad/glad.h>
 
+#include "GLState.h"
+#include "ProgramCache.h"
+
+#include <algorithm>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// fixed binding points of the uniform blocks shared between programs, blocks with these names are bound at link time
+const GLuint CAMERA_BLOCK_BINDING = 0;
+const GLuint TRANSFORMS_BLOCK_BINDING = 1;
 
 class Shader
 {
@@ -44,96 +56,274 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << e.what() << std::endl;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
+        // 2. start building the program, from the binary linked on a previous run when neither the sources nor the driver
+        // changed. Nothing here waits for the driver: errors are only checked when the program is first used (or when
+        // Poll() sees that the driver is done), so several shaders can build in parallel with the rest of startup.
+        build.reset(new Build());
+        build->vertexCode = vertexCode;
+        build->fragmentCode = fragmentCode;
+        build->cacheKey = ProgramCacheKey({ vertexCode, fragmentCode });
         ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        build->fromBinary = LoadProgramBinary(ID, build->cacheKey);
+        if (!build->fromBinary)
+        {
+            glDeleteProgram(ID);
+            compileFromSource(*build);
+        }
+    }
+    // activate the shader, waiting for it to finish building if it has not yet
+    // ------------------------------------------------------------------------
+    void use()
+    {
+        Finish();
+        GLState::Get().UseProgram(ID);
+    }
+    // true once the program is built, finishing it if the driver is done. Only blocks when the driver
+    // cannot report progress (no KHR_parallel_shader_compile).
+    // ------------------------------------------------------------------------
+    bool Poll()
+    {
+        if (!build)
+            return true;
+        if (GLCaps::Get().parallelShaderCompile)
+        {
+            GLint completed = 0;
+            glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &completed);
+            if (!completed)
+                return false;
+        }
+        Finish();
+        return true;
+    }
+    // waits for the program, reports compile/link errors and reflects its uniforms
+    // ------------------------------------------------------------------------
+    void Finish()
+    {
+        if (!build)
+            return;
+        std::unique_ptr<Build> done = std::move(build);
+        if (done->fromBinary)
+        {
+            GLint linked = 0;
+            glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+            if (!linked)
+            {
+                // a rejected binary may have left the program unusable, link a fresh one from source
+                glDeleteProgram(ID);
+                compileFromSource(*done);
+            }
+        }
+        if (!done->fromBinary)
+        {
+            checkCompileErrors(done->vertex, "VERTEX");
+            checkCompileErrors(done->fragment, "FRAGMENT");
+            checkCompileErrors(ID, "PROGRAM");
+            // delete the shaders as they're linked into our program now and no longer necessary
+            glDeleteShader(done->vertex);
+            glDeleteShader(done->fragment);
+            GLint linked = 0;
+            glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+            if (linked)
+                SaveProgramBinary(ID, done->cacheKey);
+        }
+        reflectUniforms();
+        bindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+        bindUniformBlock("Transforms", TRANSFORMS_BLOCK_BINDING);
     }
-    // activate the shader
+    // location of an active uniform, -1 if the program has none by that name (or is not built yet, see use()). No GL call.
     // ------------------------------------------------------------------------
-    void use() const
+    GLint Location(const std::string& name) const
     {
-        glUseProgram(ID);
+        std::unordered_map<std::string, GLint>::const_iterator found = locations.find(name);
+        return found != locations.end() ? found->second : -1;
     }
-    // utility uniform functions
+    // utility uniform functions. Like use() they wait for a program still building, its locations are only known once
+    // it is done. Values equal to the last one uploaded through these setters are not uploaded again.
     // ------------------------------------------------------------------------
-    void setBool(const std::string& name, bool value) const
+    void setBool(const std::string& name, bool value)
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        setInt(name, (int)value);
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string& name, int value) const
+    void setInt(const std::string& name, int value)
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        GLint location = finishedLocation(name);
+        if (changed(location, &value, sizeof(value)))
+            glUniform1i(location, value);
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string& name, float value) const
+    void setFloat(const std::string& name, float value)
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        GLint location = finishedLocation(name);
+        if (changed(location, &value, sizeof(value)))
+            glUniform1f(location, value);
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string& name, const glm::vec2& value) const
+    void setVec2(const std::string& name, const glm::vec2& value)
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        GLint location = finishedLocation(name);
+        if (changed(location, &value[0], sizeof(value)))
+            glUniform2fv(location, 1, &value[0]);
     }
-    void setVec2(const std::string& name, float x, float y) const
+    void setVec2(const std::string& name, float x, float y)
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        setVec2(name, glm::vec2(x, y));
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string& name, const glm::vec3& value) const
+    void setVec3(const std::string& name, const glm::vec3& value)
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        GLint location = finishedLocation(name);
+        if (changed(location, &value[0], sizeof(value)))
+            glUniform3fv(location, 1, &value[0]);
     }
-    void setVec3(const std::string& name, float x, float y, float z) const
+    void setVec3(const std::string& name, float x, float y, float z)
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        setVec3(name, glm::vec3(x, y, z));
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string& name, const glm::vec4& value) const
+    void setVec4(const std::string& name, const glm::vec4& value)
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        GLint location = finishedLocation(name);
+        if (changed(location, &value[0], sizeof(value)))
+            glUniform4fv(location, 1, &value[0]);
     }
-    void setVec4(const std::string& name, float x, float y, float z, float w) const
+    void setVec4(const std::string& name, float x, float y, float z, float w)
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        setVec4(name, glm::vec4(x, y, z, w));
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string& name, const glm::mat2& mat) const
+    void setMat2(const std::string& name, const glm::mat2& mat)
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location = finishedLocation(name);
+        if (changed(location, &mat[0][0], sizeof(mat)))
+            glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string& name, const glm::mat3& mat) const
+    void setMat3(const std::string& name, const glm::mat3& mat)
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location = finishedLocation(name);
+        if (changed(location, &mat[0][0], sizeof(mat)))
+            glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string& name, const glm::mat4& mat) const
+    void setMat4(const std::string& name, const glm::mat4& mat)
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        GLint location = finishedLocation(name);
+        if (changed(location, &mat[0][0], sizeof(mat)))
+            glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    // last value uploaded to a location, big enough for a mat4
+    struct UniformValue {
+        unsigned char bytes[64];
+        bool uploaded = false;
+    };
+    std::unordered_map<std::string, GLint> locations;
+    mutable std::vector<UniformValue> values; // indexed by location
+
+    // Location() once the program is finished
+    GLint finishedLocation(const std::string& name)
+    {
+        Finish();
+        return Location(name);
+    }
+
+    // records the value for the location and reports whether it differs from the previous upload
+    bool changed(GLint location, const void* value, size_t size) const
+    {
+        if (location < 0 || location >= (GLint)values.size())
+            return false;
+        UniformValue& last = values[location];
+        if (last.uploaded && memcmp(last.bytes, value, size) == 0)
+            return false;
+        memcpy(last.bytes, value, size);
+        last.uploaded = true;
+        return true;
+    }
+
+    // a program whose compile and link were submitted but not checked yet
+    struct Build {
+        std::string vertexCode;
+        std::string fragmentCode;
+        uint64_t cacheKey;
+        bool fromBinary;
+        unsigned int vertex = 0, fragment = 0;
+    };
+    std::unique_ptr<Build> build;
+
+    // submits compile and link from source, keeping the binary retrievable for the program cache. Errors are checked by Finish().
+    // ------------------------------------------------------------------------
+    void compileFromSource(Build& source)
+    {
+        const char* vShaderCode = source.vertexCode.c_str();
+        const char* fShaderCode = source.fragmentCode.c_str();
+        // vertex shader
+        source.vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(source.vertex, 1, &vShaderCode, NULL);
+        glCompileShader(source.vertex);
+        // fragment Shader
+        source.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(source.fragment, 1, &fShaderCode, NULL);
+        glCompileShader(source.fragment);
+        // shader Program
+        ID = glCreateProgram();
+        MarkProgramRetrievable(ID);
+        glAttachShader(ID, source.vertex);
+        glAttachShader(ID, source.fragment);
+        glLinkProgram(ID);
+        source.fromBinary = false;
+    }
+
+    // points the program's block of that name (if it has one) at a binding point
+    // ------------------------------------------------------------------------
+    void bindUniformBlock(const char* name, GLuint binding)
+    {
+        GLuint index = glGetUniformBlockIndex(ID, name);
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
+
+    // queries every active uniform once, so the setters never have to call glGetUniformLocation
+    // ------------------------------------------------------------------------
+    void reflectUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> buffer(maxLength > 0 ? maxLength : 1);
+        GLint maxLocation = -1;
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            if (location < 0)
+                continue; // member of a uniform block
+            locations[name] = location;
+            maxLocation = std::max(maxLocation, location);
+            // arrays are reported as "name[0]": the bare name refers to the first element, the others get their own entries
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                std::string base = name.substr(0, name.size() - 3);
+                locations[base] = location;
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    GLint elementLocation = glGetUniformLocation(ID, elementName.c_str());
+                    if (elementLocation < 0)
+                        continue;
+                    locations[elementName] = elementLocation;
+                    maxLocation = std::max(maxLocation, elementLocation);
+                }
+            }
+        }
+        values.assign(maxLocation + 1, UniformValue());
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(unsigned int shader, std::string type)
@@ -0,0 +1,56 @@
+#ifndef SHADER_MANAGER_H
+#define SHADER_MANAGER_H
+
+#include <glad/glad.h>
+
+#include "GLCaps.h"
+#include "Shader.h"
+
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Owns the programs of the application. Load() only submits the build, so every shader compiles and links
+// at the same time (on the driver's threads with KHR_parallel_shader_compile) while startup goes on;
+// a program is waited for when it is first used, Poll() picks up the finished ones before that. GL thread only.
+class ShaderManager
+{
+public:
+    ShaderManager()
+    {
+        // let the driver use as many compiler threads as it sees fit
+        if (GLCaps::Get().parallelShaderCompile)
+            GLCaps::Get().MaxShaderCompilerThreads(0xFFFFFFFFu);
+    }
+
+    // the returned shader stays valid as long as the manager
+    Shader& Load(const char* vertexPath, const char* fragmentPath)
+    {
+        shaders.emplace_back(new Shader(vertexPath, fragmentPath));
+        return *shaders.back();
+    }
+
+    // finishes the programs the driver is done with without waiting for the others, returns how many are still building
+    size_t Poll()
+    {
+        size_t building = 0;
+        for (unique_ptr<Shader>& shader : shaders)
+        {
+            if (!shader->Poll())
+                building++;
+        }
+        return building;
+    }
+
+    // waits for every program
+    void Finish()
+    {
+        for (unique_ptr<Shader>& shader : shaders)
+            shader->Finish();
+    }
+
+private:
+    vector<unique_ptr<Shader>> shaders;
+};
+#endif
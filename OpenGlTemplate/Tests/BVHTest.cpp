@@ -0,0 +1,129 @@
+// Checks BVH::Query and BVH::Raycast against testing every primitive, before and after Refit(). No GL context needed,
+// not part of the Visual Studio project. From this directory:
+//   g++ -std=c++14 -I.. -I../Libraries/include BVHTest.cpp -o BVHTest && ./BVHTest
+#include <glm/glm/glm.hpp>
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+#include "BVH.h"
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+const int PRIMITIVES = 500;
+const int QUERIES = 200;
+
+int failures = 0;
+
+void check(bool condition, const char* what, int query)
+{
+    if (condition)
+        return;
+    failures++;
+    cout << "FAILED: " << what << " (query " << query << ")" << endl;
+}
+
+Bounds randomBox(mt19937& random, float spread)
+{
+    uniform_real_distribution<float> position(-spread, spread), size(0.1f, 2.0f);
+    glm::vec3 corner(position(random), position(random), position(random));
+    glm::vec3 extent(size(random), size(random), size(random));
+    glm::vec3 corners[2] = { corner, corner + extent };
+    return ComputeBounds(corners, 2);
+}
+
+// what Query has to return: every primitive the frustum intersects
+vector<uint32_t> queryAll(const vector<Bounds>& primitives, const Frustum& frustum)
+{
+    vector<uint32_t> visible;
+    for (uint32_t i = 0; i < primitives.size(); i++)
+        if (frustum.Intersects(primitives[i]))
+            visible.push_back(i);
+    return visible;
+}
+
+// what Raycast has to find: the nearest box entry within maxDistance
+bool raycastAll(const vector<Bounds>& primitives, const Ray& ray, float maxDistance, RayHit& hit)
+{
+    glm::vec3 inverseDirection = InverseDirection(ray.direction);
+    bool found = false;
+    for (uint32_t i = 0; i < primitives.size(); i++)
+    {
+        float distance;
+        if (IntersectRayBox(ray, inverseDirection, primitives[i].min, primitives[i].max, maxDistance, distance) && (!found || distance < hit.distance))
+        {
+            hit.primitive = i;
+            hit.distance = distance;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void compare(const BVH& bvh, const vector<Bounds>& primitives, mt19937& random)
+{
+    uniform_real_distribution<float> unit(-1.0f, 1.0f), angle(0.0f, 6.2831853f);
+    for (int q = 0; q < QUERIES; q++)
+    {
+        glm::vec3 eye(unit(random) * 30.0f, unit(random) * 30.0f, unit(random) * 30.0f);
+        glm::vec3 target(unit(random) * 10.0f, unit(random) * 10.0f, unit(random) * 10.0f);
+        glm::mat4 view = glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 projection = glm::perspective(glm::radians(30.0f + 30.0f * (unit(random) + 1.0f)), 1.5f, 0.1f, 40.0f);
+        Frustum frustum(projection * view);
+
+        vector<uint32_t> visible;
+        bvh.Query(frustum, visible);
+        sort(visible.begin(), visible.end());
+        check(visible == queryAll(primitives, frustum), "Query matches testing every primitive", q);
+
+        Ray ray;
+        ray.origin = eye;
+        ray.direction = glm::normalize(target - eye + glm::vec3(unit(random), unit(random), unit(random)));
+        RayHit expected = { 0, 0.0f }, hit = { 0, 0.0f };
+        bool expectedFound = raycastAll(primitives, ray, 60.0f, expected);
+        bool found = bvh.Raycast(ray, 60.0f, hit);
+        check(found == expectedFound, "Raycast hits exactly when some box is hit", q);
+        if (found && expectedFound)
+            check(hit.distance == expected.distance, "Raycast finds the nearest box", q);
+    }
+}
+
+int main()
+{
+    mt19937 random(7);
+    vector<Bounds> primitives;
+    for (int i = 0; i < PRIMITIVES; i++)
+        primitives.push_back(randomBox(random, 20.0f));
+
+    BVH bvh;
+    bvh.Build(primitives);
+    compare(bvh, primitives, random);
+
+    // move everything, as a changed node transform would, and refit without rebuilding
+    glm::mat4 moved = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, -2.0f, 5.0f)), 0.7f, glm::vec3(0.0f, 1.0f, 0.0f));
+    for (size_t i = 0; i < primitives.size(); i += 2)
+        primitives[i] = TransformBounds(primitives[i], moved);
+    size_t nodeCount = bvh.NodeCount();
+    bvh.Refit(primitives);
+    check(bvh.NodeCount() == nodeCount, "Refit keeps the tree", 0);
+    compare(bvh, primitives, random);
+
+    BVH empty;
+    empty.Build(vector<Bounds>());
+    vector<uint32_t> visible;
+    empty.Query(Frustum(), visible);
+    RayHit hit;
+    Ray ray = { glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f) };
+    check(visible.empty() && !empty.Raycast(ray, 10.0f, hit), "an empty BVH finds nothing", 0);
+
+    if (failures > 0)
+    {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "BVH: all checks passed" << endl;
+    return 0;
+}
@@ -0,0 +1,132 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include "GLState.h"
+#include "TextureLoader.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <climits>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Process-wide registry of loaded textures, keyed by normalized absolute path plus the upload flags.
+// Every Acquire() must be paired with a Release(); the GL texture is deleted when the last user releases it,
+// so several models sharing an image decode and store it only once. GL thread only.
+class TextureCache
+{
+public:
+    static TextureCache& Shared()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // returns the texture for the given file, loading it on first use
+    unsigned int Acquire(const string& path, bool gamma = false)
+    {
+        string key = NormalizePath(path) + (gamma ? "|srgb" : "|linear");
+        unordered_map<string, Entry>::iterator found = entries.find(key);
+        if (found != entries.end())
+        {
+            found->second.references++;
+            return found->second.id;
+        }
+
+        Entry entry;
+        entry.id = TextureLoader::Shared().Load(path, gamma);
+        entry.references = 1;
+        entries.emplace(key, entry);
+        keys.emplace(entry.id, key);
+        return entry.id;
+    }
+
+    // drops one reference, deleting the texture once nobody uses it anymore
+    void Release(unsigned int textureID)
+    {
+        unordered_map<unsigned int, string>::iterator key = keys.find(textureID);
+        if (key == keys.end())
+            return;
+        unordered_map<string, Entry>::iterator entry = entries.find(key->second);
+        if (--entry->second.references > 0)
+            return;
+
+        TextureLoader::Shared().Cancel(textureID);
+        GLState::Get().ForgetTexture(textureID);
+        glDeleteTextures(1, &textureID);
+        entries.erase(entry);
+        keys.erase(key);
+    }
+
+    // number of distinct textures currently alive
+    size_t Size() const { return entries.size(); }
+
+    // absolute path with forward slashes and no '.'/'..' segments (lower case on Windows, where paths are case insensitive)
+    static string NormalizePath(const string& path)
+    {
+        string absolute;
+#ifdef _WIN32
+        char buffer[_MAX_PATH];
+        if (_fullpath(buffer, path.c_str(), _MAX_PATH))
+            absolute = buffer;
+#else
+        char buffer[PATH_MAX];
+        if (realpath(path.c_str(), buffer))
+            absolute = buffer;
+        else if (!path.empty() && path[0] != '/' && getcwd(buffer, sizeof(buffer)))
+            absolute = string(buffer) + '/' + path; // missing file, still give it a stable key
+#endif
+        if (absolute.empty())
+            absolute = path;
+
+        // collapse the segments lexically, _fullpath and the fallback above may leave some behind
+        vector<string> segments;
+        string segment;
+        for (size_t i = 0; i <= absolute.size(); i++)
+        {
+            char c = i < absolute.size() ? absolute[i] : '/';
+            if (c != '/' && c != '\\')
+            {
+                segment += c;
+                continue;
+            }
+            if (segment == "..")
+            {
+                if (!segments.empty() && segments.back() != "..")
+                    segments.pop_back();
+            }
+            else if (!segment.empty() && segment != ".")
+                segments.push_back(segment);
+            segment.clear();
+        }
+
+        string normalized = (absolute[0] == '/' || absolute[0] == '\\') ? "/" : "";
+        for (size_t i = 0; i < segments.size(); i++)
+            normalized += (i > 0 ? "/" : "") + segments[i];
+#ifdef _WIN32
+        for (char& c : normalized)
+            c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+#endif
+        return normalized;
+    }
+
+private:
+    struct Entry {
+        unsigned int id;
+        unsigned int references;
+    };
+    unordered_map<string, Entry> entries;
+    unordered_map<unsigned int, string> keys;
+
+    TextureCache() {}
+};
+#endif
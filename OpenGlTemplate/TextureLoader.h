@@ -0,0 +1,176 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+
+#include "GLState.h"
+#include "ThreadPool.h"
+#include <stb_image.h>
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+// Decodes image files on the worker pool and uploads them on the GL thread.
+// Load() hands out a valid texture id immediately, filled with a 1x1 placeholder, and Pump() later
+// replaces its contents with the decoded image, so meshes can be drawn while their textures are still decoding.
+class TextureLoader
+{
+public:
+    static TextureLoader& Shared()
+    {
+        static TextureLoader loader;
+        return loader;
+    }
+
+    // creates the texture with placeholder contents and queues the file for decoding. GL thread only.
+    unsigned int Load(const string& filename, bool gamma = false)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        GLState::Get().BindTexture(textureID);
+        const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        // no mipmaps yet, so the placeholder must not use a mipmapped filter or it would be incomplete
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        state->pending++;
+        uint64_t ticket = nextTicket++;
+        inFlight[textureID] = ticket;
+        shared_ptr<State> shared = state;
+        ThreadPool::Shared().Submit([shared, ticket, textureID, filename, gamma]
+        {
+            DecodedImage image;
+            image.ticket = ticket;
+            image.textureID = textureID;
+            image.path = filename;
+            image.gamma = gamma;
+            image.pixels = stbi_load(filename.c_str(), &image.width, &image.height, &image.components, 0);
+            lock_guard<mutex> lock(shared->readyMutex);
+            shared->ready.push_back(image);
+        });
+        return textureID;
+    }
+
+    // uploads up to maxUploads decoded images, call once per frame on the GL thread. Returns how many were uploaded.
+    unsigned int Pump(unsigned int maxUploads = 4)
+    {
+        vector<DecodedImage> batch;
+        {
+            lock_guard<mutex> lock(state->readyMutex);
+            size_t count = min(state->ready.size(), static_cast<size_t>(maxUploads));
+            batch.assign(state->ready.begin(), state->ready.begin() + count);
+            state->ready.erase(state->ready.begin(), state->ready.begin() + count);
+        }
+        for (DecodedImage& image : batch)
+        {
+            unordered_map<unsigned int, uint64_t>::iterator load = inFlight.find(image.textureID);
+            if (load != inFlight.end() && load->second == image.ticket)
+                inFlight.erase(load);
+            upload(image);
+            state->pending--;
+        }
+        return static_cast<unsigned int>(batch.size());
+    }
+
+    // blocks until every queued texture has been decoded and uploaded
+    void Finish()
+    {
+        while (Pending() > 0)
+        {
+            if (Pump(~0u) == 0)
+                this_thread::yield();
+        }
+    }
+
+    // the texture is about to be deleted, drop its image instead of uploading it. GL thread only.
+    void Cancel(unsigned int textureID)
+    {
+        unordered_map<unsigned int, uint64_t>::iterator load = inFlight.find(textureID);
+        if (load == inFlight.end())
+            return;
+        // remembered per load rather than per id, the id may be handed out again before the old decode finishes
+        canceled.insert(load->second);
+        inFlight.erase(load);
+    }
+
+    // textures that are queued or decoded but not uploaded yet
+    unsigned int Pending() const { return state->pending; }
+
+private:
+    struct DecodedImage {
+        uint64_t ticket;
+        unsigned int textureID;
+        string path;
+        bool gamma;
+        unsigned char* pixels;
+        int width, height, components;
+    };
+    // shared with the decode tasks so late finishing workers never outlive it
+    struct State {
+        mutex readyMutex;
+        vector<DecodedImage> ready;
+        atomic<unsigned int> pending{ 0 };
+        ~State()
+        {
+            for (DecodedImage& image : ready)
+                stbi_image_free(image.pixels);
+        }
+    };
+    shared_ptr<State> state = make_shared<State>();
+    // only touched on the GL thread
+    uint64_t nextTicket = 0;
+    unordered_map<unsigned int, uint64_t> inFlight;
+    unordered_set<uint64_t> canceled;
+
+    TextureLoader() {}
+
+    void upload(const DecodedImage& image)
+    {
+        if (canceled.erase(image.ticket) > 0)
+        {
+            stbi_image_free(image.pixels);
+            return;
+        }
+        if (!image.pixels)
+        {
+            std::cout << "Texture failed to load at path: " << image.path << std::endl;
+            return;
+        }
+
+        GLenum format = GL_RGBA;
+        if (image.components == 1)
+            format = GL_RED;
+        else if (image.components == 3)
+            format = GL_RGB;
+        else if (image.components == 4)
+            format = GL_RGBA;
+        // gamma corrected textures are stored as sRGB so sampling returns linear values
+        GLint internalFormat = format;
+        if (image.gamma && format == GL_RGB)
+            internalFormat = GL_SRGB;
+        else if (image.gamma && format == GL_RGBA)
+            internalFormat = GL_SRGB_ALPHA;
+
+        GLState::Get().BindTexture(image.textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels);
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        stbi_image_free(image.pixels);
+    }
+};
+#endif
@@ -0,0 +1,119 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// A fixed set of worker threads pulling tasks from a shared queue. Workers never touch OpenGL,
+// anything that needs the context has to be handed back to the thread that owns it.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int threadCount)
+    {
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (thread& worker : workers)
+            worker.join();
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // process-wide pool sized to the machine, leaving one core for the render thread
+    static ThreadPool& Shared()
+    {
+        static ThreadPool pool(thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 1);
+        return pool;
+    }
+
+    unsigned int Size() const { return static_cast<unsigned int>(workers.size()); }
+
+    // queues a task for any worker, returns immediately
+    void Submit(function<void()> task)
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            tasks.push(move(task));
+        }
+        wakeUp.notify_one();
+    }
+
+    // runs body(i) for every i in [0, count) on the workers and the calling thread, returns once all are done.
+    // indices are handed out one by one so uneven items (a huge mesh next to tiny ones) still balance out.
+    template <typename Body>
+    void ParallelFor(size_t count, const Body& body)
+    {
+        if (count == 0)
+            return;
+        // shared so that helpers which only get scheduled after we returned still find valid state
+        struct Job {
+            atomic<size_t> next{ 0 };
+            atomic<size_t> completed{ 0 };
+            mutex doneMutex;
+            condition_variable done;
+        };
+        shared_ptr<Job> job = make_shared<Job>();
+        const Body* work = &body;
+        size_t total = count;
+        auto drain = [job, work, total]
+        {
+            for (size_t i = job->next++; i < total; i = job->next++)
+            {
+                (*work)(i);
+                if (++job->completed == total)
+                {
+                    lock_guard<mutex> lock(job->doneMutex);
+                    job->done.notify_all();
+                }
+            }
+        };
+        size_t helpers = min(static_cast<size_t>(Size()), count - 1);
+        for (size_t i = 0; i < helpers; i++)
+            Submit(drain);
+        drain();
+        unique_lock<mutex> lock(job->doneMutex);
+        job->done.wait(lock, [&] { return job->completed == total; });
+    }
+
+private:
+    vector<thread> workers;
+    queue<function<void()>> tasks;
+    mutex queueMutex;
+    condition_variable wakeUp;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                wakeUp.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                    return;
+                task = move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
+#endif
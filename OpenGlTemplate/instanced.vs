@@ -0,0 +1,30 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// per-instance model matrix from an InstanceBuffer, takes locations 4 to 7
+layout (location = 4) in mat4 aInstanceModel;
+
+out vec2 TexCoords;
+
+// per-frame camera data, shared by all programs (see CameraUniforms.h)
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPos;
+    float time;
+};
+
+// places the mesh inside the model (its scene graph node), a range of the frame's ring buffer bound by the render queue
+layout (std140) uniform Transforms
+{
+    mat4 model;
+};
+
+void main()
+{
+    TexCoords = aTexCoords;    
+    gl_Position = viewProjection * aInstanceModel * model * vec4(aPos, 1.0);
+}
\ No newline at end of file
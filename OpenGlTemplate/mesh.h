@@ -5,9 +5,18 @@
 
 #include <glm/glm/glm.hpp>
 #include <glm/glm/gtc/matrix_transform.hpp>
+#include <glm/glm/gtc/packing.hpp>
+#include <glm/glm/packing.hpp>
 
+#include "Bounds.h"
+#include "Frustum.h"
+#include "GLState.h"
+#include "Ray.h"
 #include "Shader.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -31,95 +40,737 @@ struct Vertex {
     float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// layout of the vertex buffer on the GPU. The CPU side always keeps the full Vertex, packing happens at upload.
+enum VertexFormat {
+    // the Vertex struct as is, 88 bytes
+    VERTEX_FORMAT_FULL,
+    // float position, 10:10:10:2 normal and tangent (bitangent sign in w), half float uvs: 24 bytes
+    VERTEX_FORMAT_PACKED,
+    // as VERTEX_FORMAT_PACKED but with half float positions, for assets of moderate size: 20 bytes
+    VERTEX_FORMAT_PACKED_HALF_POSITION
+};
+
+// attribute locations shared by every vertex format and the shaders.
+// the packed formats use normalized integer and half float attributes, so shaders see the same vec3/vec2 inputs;
+// the bitangent is rebuilt as cross(normal, tangent.xyz) * tangent.w. Bone data is not uploaded, nothing is skinned yet.
+const GLuint ATTRIBUTE_POSITION = 0;
+const GLuint ATTRIBUTE_NORMAL = 1;
+const GLuint ATTRIBUTE_TEXCOORDS = 2;
+const GLuint ATTRIBUTE_TANGENT = 3;
+// per-instance model matrix, one column per location (4 to 7), fed from an InstanceBuffer
+const GLuint ATTRIBUTE_INSTANCE_MODEL = 4;
+
+// bytes per vertex in the GPU buffer
+inline size_t VertexStride(VertexFormat format)
+{
+    switch (format)
+    {
+    case VERTEX_FORMAT_PACKED: return 24;
+    case VERTEX_FORMAT_PACKED_HALF_POSITION: return 20;
+    default: return sizeof(Vertex);
+    }
+}
+
+// converts vertices into the GPU layout of the given format
+inline vector<unsigned char> PackVertices(const vector<Vertex>& vertices, VertexFormat format)
+{
+    size_t stride = VertexStride(format);
+    vector<unsigned char> packed(vertices.size() * stride);
+    if (format == VERTEX_FORMAT_FULL)
+    {
+        if (!vertices.empty())
+            memcpy(packed.data(), vertices.data(), packed.size());
+        return packed;
+    }
+
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        const Vertex& vertex = vertices[i];
+        unsigned char* out = &packed[i * stride];
+        size_t offset = 0;
+        if (format == VERTEX_FORMAT_PACKED)
+        {
+            memcpy(out, &vertex.Position, 12);
+            offset = 12;
+        }
+        else
+        {
+            uint64_t position = glm::packHalf4x16(glm::vec4(vertex.Position, 1.0f));
+            memcpy(out, &position, 8);
+            offset = 8;
+        }
+        // the tangent frame is stored as normal + tangent, the handedness of the bitangent goes into the 2 bit w
+        float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+        uint32_t normal = glm::packSnorm3x10_1x2(glm::vec4(glm::clamp(vertex.Normal, -1.0f, 1.0f), 0.0f));
+        uint32_t tangent = glm::packSnorm3x10_1x2(glm::vec4(glm::clamp(vertex.Tangent, -1.0f, 1.0f), handedness));
+        uint32_t texCoords = glm::packHalf2x16(vertex.TexCoords);
+        memcpy(out + offset, &normal, 4);
+        memcpy(out + offset + 4, &tangent, 4);
+        memcpy(out + offset + 8, &texCoords, 4);
+    }
+    return packed;
+}
+
+// sets the attribute pointers for the vertex buffer bound to GL_ARRAY_BUFFER, the VAO must be bound
+inline void SetupVertexAttributes(VertexFormat format)
+{
+    GLsizei stride = static_cast<GLsizei>(VertexStride(format));
+    if (format == VERTEX_FORMAT_FULL)
+    {
+        // vertex positions
+        glEnableVertexAttribArray(ATTRIBUTE_POSITION);
+        glVertexAttribPointer(ATTRIBUTE_POSITION, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(ATTRIBUTE_NORMAL);
+        glVertexAttribPointer(ATTRIBUTE_NORMAL, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(ATTRIBUTE_TEXCOORDS);
+        glVertexAttribPointer(ATTRIBUTE_TEXCOORDS, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, TexCoords));
+        return;
+    }
+
+    size_t offset = 0;
+    glEnableVertexAttribArray(ATTRIBUTE_POSITION);
+    if (format == VERTEX_FORMAT_PACKED)
+    {
+        glVertexAttribPointer(ATTRIBUTE_POSITION, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+        offset = 12;
+    }
+    else
+    {
+        glVertexAttribPointer(ATTRIBUTE_POSITION, 4, GL_HALF_FLOAT, GL_FALSE, stride, (void*)0);
+        offset = 8;
+    }
+    glEnableVertexAttribArray(ATTRIBUTE_NORMAL);
+    glVertexAttribPointer(ATTRIBUTE_NORMAL, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offset);
+    glEnableVertexAttribArray(ATTRIBUTE_TANGENT);
+    glVertexAttribPointer(ATTRIBUTE_TANGENT, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(offset + 4));
+    glEnableVertexAttribArray(ATTRIBUTE_TEXCOORDS);
+    glVertexAttribPointer(ATTRIBUTE_TEXCOORDS, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)(offset + 8));
+}
+
+// a run of triangles drawn with a single glDrawElementsBaseVertex call
+struct DrawRange {
+    // first index and number of indices in the mesh's index buffer
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    // added to every index by the GPU, lets 16 bit ranges address vertices past 65535
+    int baseVertex;
+};
+
+// one level of detail: a part of the mesh's index list drawing the mesh's vertices with fewer triangles
+struct MeshLod {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    // how far (in node space) the simplification moved the surface at most, 0 for the full mesh
+    float error;
+};
+static_assert(sizeof(MeshLod) == 12, "MeshLod is stored in the mesh cache, its size is part of the file layout");
+
+// levels of detail a mesh can have, the full mesh included
+const int MAX_MESH_LODS = 4;
+
+// a small cluster of the full mesh's triangles (see BuildMeshlets), culled on its own every frame
+struct Meshlet {
+    // part of the mesh's index list, within level 0
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    // node space bounding sphere of the meshlet's vertices
+    glm::vec3    center;
+    float        radius;
+    // the triangle normals lie within the cone around coneAxis whose half angle has sine coneCutoff, 1 when they
+    // spread too far for the meshlet to ever face away as a whole
+    glm::vec3    coneAxis;
+    float        coneCutoff;
+};
+static_assert(sizeof(Meshlet) == 40, "Meshlet is stored in the mesh cache, its size is part of the file layout");
+
+// most ranges a large mesh is split into before falling back to 32 bit indices, more draws cost more than they save
+const size_t MAX_16BIT_RANGES = 16;
+
+// converts indices into the narrowest index type that can address the mesh: 16 bit when it has at most 65536 vertices,
+// otherwise (if allowed) 16 bit sub-ranges that each span less than 65536 vertices, otherwise 32 bit.
+// Fills in the GL index type and the ranges to draw, returns the index buffer contents.
+inline vector<unsigned char> BuildIndexBuffer(const vector<unsigned int>& indices, size_t vertexCount, bool split16BitRanges,
+                                              GLenum& indexType, vector<DrawRange>& ranges)
+{
+    ranges.clear();
+    if (vertexCount <= 65536)
+    {
+        DrawRange range = { 0, static_cast<unsigned int>(indices.size()), 0 };
+        ranges.push_back(range);
+    }
+    else if (split16BitRanges)
+    {
+        // greedy over whole triangles: a range ends when the next triangle would stretch it past 65536 vertices.
+        // works well on vertex-fetch optimized meshes, where indices grow roughly monotonically.
+        unsigned int rangeMin = ~0u, rangeMax = 0;
+        DrawRange range = { 0, 0, 0 };
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            unsigned int triangleMin = min(indices[t], min(indices[t + 1], indices[t + 2]));
+            unsigned int triangleMax = max(indices[t], max(indices[t + 1], indices[t + 2]));
+            if (range.indexCount > 0 && max(rangeMax, triangleMax) - min(rangeMin, triangleMin) > 65535)
+            {
+                range.baseVertex = static_cast<int>(rangeMin);
+                ranges.push_back(range);
+                range.firstIndex = static_cast<unsigned int>(t);
+                range.indexCount = 0;
+                rangeMin = ~0u;
+                rangeMax = 0;
+            }
+            rangeMin = min(rangeMin, triangleMin);
+            rangeMax = max(rangeMax, triangleMax);
+            range.indexCount += 3;
+        }
+        if (range.indexCount > 0)
+        {
+            range.baseVertex = static_cast<int>(rangeMin);
+            ranges.push_back(range);
+        }
+        if (ranges.size() > MAX_16BIT_RANGES)
+            ranges.clear();
+    }
+
+    vector<unsigned char> data;
+    if (ranges.empty())
+    {
+        indexType = GL_UNSIGNED_INT;
+        DrawRange range = { 0, static_cast<unsigned int>(indices.size()), 0 };
+        ranges.push_back(range);
+        data.resize(indices.size() * sizeof(unsigned int));
+        if (!indices.empty())
+            memcpy(data.data(), indices.data(), data.size());
+        return data;
+    }
+
+    indexType = GL_UNSIGNED_SHORT;
+    data.resize(indices.size() * sizeof(unsigned short));
+    unsigned short* narrow = reinterpret_cast<unsigned short*>(data.data());
+    for (const DrawRange& range : ranges)
+        for (unsigned int i = range.firstIndex; i < range.firstIndex + range.indexCount; i++)
+            narrow[i] = static_cast<unsigned short>(indices[i] - range.baseVertex);
+    return data;
+}
+
+// BuildIndexBuffer for an index list holding several levels of detail: each level gets ranges of its own, all of
+// them in ranges with level i's starting at lodFirstRanges[i] (one extra entry closes the last level). When the
+// levels come out with different index types, all of them are rebuilt with 32 bit indices.
+inline vector<unsigned char> BuildLodIndexBuffer(const vector<unsigned int>& indices, const vector<MeshLod>& lods, size_t vertexCount,
+                                                 bool split16BitRanges, GLenum& indexType, vector<DrawRange>& ranges,
+                                                 vector<unsigned int>& lodFirstRanges)
+{
+    vector<unsigned char> data;
+    ranges.clear();
+    lodFirstRanges.clear();
+    for (size_t i = 0; i < lods.size(); i++)
+    {
+        vector<unsigned int> lodIndices(indices.begin() + lods[i].firstIndex, indices.begin() + lods[i].firstIndex + lods[i].indexCount);
+        GLenum lodType;
+        vector<DrawRange> lodRanges;
+        vector<unsigned char> lodData = BuildIndexBuffer(lodIndices, vertexCount, split16BitRanges, lodType, lodRanges);
+        if (i > 0 && lodType != indexType)
+            return BuildLodIndexBuffer(indices, lods, vertexCount, false, indexType, ranges, lodFirstRanges);
+        indexType = lodType;
+        lodFirstRanges.push_back(static_cast<unsigned int>(ranges.size()));
+        for (DrawRange& range : lodRanges)
+        {
+            range.firstIndex += lods[i].firstIndex;
+            ranges.push_back(range);
+        }
+        data.insert(data.end(), lodData.begin(), lodData.end());
+    }
+    lodFirstRanges.push_back(static_cast<unsigned int>(ranges.size()));
+    return data;
+}
+
+inline size_t IndexSize(GLenum indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+}
+
+// what a mesh keeps in system memory once its buffers are on the GPU
+enum GeometryRetention {
+    // vertices and indices stay resident, e.g. to write caches or re-upload later
+    GEOMETRY_KEEP,
+    // only the GPU copy remains
+    GEOMETRY_DISCARD,
+    // a tightly packed position array plus the indices, enough for picking and bounds
+    GEOMETRY_POSITIONS_ONLY
+};
+
+// One vertex buffer, one index buffer and one VAO shared by many meshes of the same vertex format.
+// Meshes append their data while loading and the arena uploads everything at once with Upload(); each mesh then
+// draws its own slice through a base vertex and first index, so a whole model is drawn without switching VAOs.
+class GeometryArena
+{
+public:
+    // where a mesh's data starts inside the shared buffers
+    struct Slot {
+        unsigned int firstIndex;
+        int baseVertex;
+    };
+
+    explicit GeometryArena(VertexFormat vertexFormat) : vertexFormat(vertexFormat) {}
+    ~GeometryArena()
+    {
+        if (VAO != 0)
+        {
+            GLState::Get().ForgetVertexArray(VAO);
+            glDeleteVertexArrays(1, &VAO);
+        }
+        if (VBO != 0)
+            glDeleteBuffers(1, &VBO);
+        if (EBO != 0)
+            glDeleteBuffers(1, &EBO);
+    }
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+    // takes a mesh's packed vertices and its index buffer as built by BuildIndexBuffer, returns the mesh's slot
+    unsigned int Append(const vector<unsigned char>& vertexData, vector<unsigned char>&& indexData, GLenum type)
+    {
+        Slot slot;
+        slot.firstIndex = static_cast<unsigned int>(indexCount);
+        slot.baseVertex = static_cast<int>(vertexCount);
+        slots.push_back(slot);
+
+        vertexBytes.insert(vertexBytes.end(), vertexData.begin(), vertexData.end());
+        vertexCount += vertexData.size() / VertexStride(vertexFormat);
+        indexCount += indexData.size() / IndexSize(type);
+        // one 32 bit mesh makes the whole arena 32 bit, the 16 bit ones are widened on upload
+        if (type == GL_UNSIGNED_INT)
+            indexType = GL_UNSIGNED_INT;
+        IndexChunk chunk = { type, move(indexData) };
+        indexChunks.push_back(move(chunk));
+        return static_cast<unsigned int>(slots.size() - 1);
+    }
+
+    // creates the buffers from everything appended so far and frees the staging copies, call once on the GL thread
+    void Upload()
+    {
+        vector<unsigned char> indexData(indexCount * IndexSize(indexType));
+        size_t offset = 0;
+        for (const IndexChunk& chunk : indexChunks)
+        {
+            if (chunk.type == indexType)
+            {
+                if (!chunk.data.empty())
+                    memcpy(indexData.data() + offset, chunk.data.data(), chunk.data.size());
+                offset += chunk.data.size();
+                continue;
+            }
+            // values stay relative to their range's base vertex, only the width changes
+            const unsigned short* narrow = reinterpret_cast<const unsigned short*>(chunk.data.data());
+            for (size_t i = 0; i < chunk.data.size() / sizeof(unsigned short); i++)
+            {
+                unsigned int wide = narrow[i];
+                memcpy(indexData.data() + offset, &wide, sizeof(unsigned int));
+                offset += sizeof(unsigned int);
+            }
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+
+        GLState::Get().BindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes.size(), vertexBytes.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), indexData.data(), GL_STATIC_DRAW);
+        SetupVertexAttributes(vertexFormat);
+        GLState::Get().BindVertexArray(0);
+
+        vector<unsigned char>().swap(vertexBytes);
+        vector<IndexChunk>().swap(indexChunks);
+    }
+
+    unsigned int VertexArray() const { return VAO; }
+    // index type of the shared index buffer, only final once every mesh was appended
+    GLenum IndexType() const { return indexType; }
+    const Slot& GetSlot(unsigned int slot) const { return slots[slot]; }
+    size_t VertexBytes() const { return vertexCount * VertexStride(vertexFormat); }
+    size_t IndexBytes() const { return indexCount * IndexSize(indexType); }
+
+private:
+    struct IndexChunk {
+        GLenum type;
+        vector<unsigned char> data;
+    };
+    VertexFormat vertexFormat;
+    GLenum indexType = GL_UNSIGNED_SHORT;
+    vector<Slot> slots;
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    // staging data, gone after Upload()
+    vector<unsigned char> vertexBytes;
+    vector<IndexChunk> indexChunks;
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+};
+
 struct Texture {
     unsigned int id;
     string type;
     string path;
 };
 
+// the sampler each texture is bound to, following the texture_diffuseN, texture_specularN, ... naming convention.
+// computed once per texture list so drawing does not build strings.
+inline vector<string> SamplerNames(const vector<Texture>& textures)
+{
+    unsigned int diffuseNr = 1;
+    unsigned int specularNr = 1;
+    unsigned int normalNr = 1;
+    unsigned int heightNr = 1;
+    vector<string> samplers;
+    samplers.reserve(textures.size());
+    for (const Texture& texture : textures)
+    {
+        // retrieve texture number (the N in diffuse_textureN)
+        string number;
+        const string& name = texture.type;
+        if (name == "texture_diffuse")
+            number = std::to_string(diffuseNr++);
+        else if (name == "texture_specular")
+            number = std::to_string(specularNr++); // transfer unsigned int to string
+        else if (name == "texture_normal")
+            number = std::to_string(normalNr++); // transfer unsigned int to string
+        else if (name == "texture_height")
+            number = std::to_string(heightNr++); // transfer unsigned int to string
+        samplers.push_back(name + number);
+    }
+    return samplers;
+}
+
+// binds the textures to consecutive units and points their samplers (see SamplerNames) at them
+inline void BindTextures(Shader& shader, const vector<Texture>& textures, const vector<string>& samplers)
+{
+    for (unsigned int i = 0; i < textures.size(); i++)
+    {
+        // now set the sampler to the correct texture unit
+        shader.setInt(samplers[i], i);
+        // and bind the texture, GLState only switches the active unit when the binding changes
+        GLState::Get().BindTexture(i, textures[i].id);
+    }
+}
+
 class Mesh {
 public:
     // mesh data
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    // sampler uniform of each texture
+    vector<string>       samplers;
+    VertexFormat         vertexFormat;
+    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, whichever is the narrowest that works for this mesh
+    GLenum               indexType;
+    // the draw ranges of every level of detail, see LodRanges()
+    vector<DrawRange>    ranges;
+    // level 0 is the full mesh, the others follow it in indices
+    vector<MeshLod>      lods;
+    // level 0 split into clusters, empty unless the model was imported with meshlets
+    vector<Meshlet>      meshlets;
+    // what ReleaseGeometry left behind: positions for GEOMETRY_POSITIONS_ONLY, indices unless GEOMETRY_DISCARD
+    vector<glm::vec3>    positions;
+    size_t               vertexCount;
+    size_t               indexCount;
+    // node space bounds, computed at import
+    Bounds               bounds = EmptyBounds();
+    // node of the model's SceneGraph that places the mesh
+    uint32_t             node = 0;
 
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // takes ownership of the geometry, pass the vectors with move() to avoid copying them.
+    // with an arena the geometry goes into its shared buffers (which must use the same vertex format) instead of buffers of its own.
+    // lods describes the levels of detail in indices (see GenerateLods), without them the whole list is the only level.
+    // meshlets cover level 0 (see BuildMeshlets).
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, VertexFormat vertexFormat = VERTEX_FORMAT_FULL,
+         bool split16BitRanges = false, GeometryArena* arena = nullptr, vector<MeshLod> lods = vector<MeshLod>(),
+         vector<Meshlet> meshlets = vector<Meshlet>())
+        : vertices(move(vertices)), indices(move(indices)), textures(move(textures)), vertexFormat(vertexFormat), lods(move(lods)),
+          meshlets(move(meshlets)), split16BitRanges(split16BitRanges), arena(arena)
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        this->vertexCount = this->vertices.size();
+        this->indexCount = this->indices.size();
+        this->samplers = SamplerNames(this->textures);
+        if (this->lods.empty())
+        {
+            MeshLod full = { 0, static_cast<unsigned int>(this->indexCount), 0.0f };
+            this->lods.push_back(full);
+        }
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
     }
+
+    // a mesh owns its GL objects: it can be moved but not copied
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    Mesh(Mesh&& other) noexcept
+    {
+        *this = move(other);
+    }
+    Mesh& operator=(Mesh&& other) noexcept
+    {
+        if (this == &other)
+            return *this;
+        deleteBuffers();
+        vertices = move(other.vertices);
+        indices = move(other.indices);
+        textures = move(other.textures);
+        samplers = move(other.samplers);
+        vertexFormat = other.vertexFormat;
+        indexType = other.indexType;
+        ranges = move(other.ranges);
+        lods = move(other.lods);
+        lodFirstRanges = move(other.lodFirstRanges);
+        meshlets = move(other.meshlets);
+        meshletRanges = move(other.meshletRanges);
+        meshletFirstRanges = move(other.meshletFirstRanges);
+        positions = move(other.positions);
+        vertexCount = other.vertexCount;
+        indexCount = other.indexCount;
+        bounds = other.bounds;
+        node = other.node;
+        split16BitRanges = other.split16BitRanges;
+        arena = other.arena;
+        arenaSlot = other.arenaSlot;
+        VAO = other.VAO;
+        VBO = other.VBO;
+        EBO = other.EBO;
+        other.VAO = other.VBO = other.EBO = 0;
+        return *this;
+    }
+    ~Mesh()
+    {
+        deleteBuffers();
+    }
+
+    // textures and VAO are bound through GLState and left bound, so meshes sharing them (or an arena) do not rebind
     void Draw(Shader& shader)
     {
         // bind appropriate textures
-        unsigned int diffuseNr = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr = 1;
-        unsigned int heightNr = 1;
-        for (unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if (name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if (name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-            else if (name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to string
-            else if (name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to string
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        }
+        BindTextures(shader, textures, samplers);
 
         // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        GLState::Get().BindVertexArray(VertexArray());
+        DrawElements();
+    }
+
+    // issues the draw calls of a level of detail only, with textures and VertexArray() already bound
+    void DrawElements(int lod = 0) const
+    {
+        GLenum type = BufferIndexType();
+        for (size_t i = LodFirstRange(lod); i < LodFirstRange(lod) + LodRangeCount(lod); i++)
+        {
+            const DrawRange& range = ranges[i];
+            DrawRange buffer = BufferRange(range);
+            glDrawElementsBaseVertex(GL_TRIANGLES, buffer.indexCount, type, (void*)(buffer.firstIndex * IndexSize(type)), buffer.baseVertex);
+        }
+    }
+
+    // the same, drawing instanceCount copies with the instance attributes attached to VertexArray()
+    void DrawElementsInstanced(GLsizei instanceCount, int lod = 0) const
+    {
+        GLenum type = BufferIndexType();
+        for (size_t i = LodFirstRange(lod); i < LodFirstRange(lod) + LodRangeCount(lod); i++)
+        {
+            const DrawRange& range = ranges[i];
+            DrawRange buffer = BufferRange(range);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, buffer.indexCount, type, (void*)(buffer.firstIndex * IndexSize(type)),
+                                              instanceCount, buffer.baseVertex);
+        }
+    }
+
+    int LodCount() const { return static_cast<int>(lods.size()); }
+    // the ranges in ranges that draw a level of detail
+    size_t LodFirstRange(int lod) const { return lodFirstRanges[lod]; }
+    size_t LodRangeCount(int lod) const { return lodFirstRanges[lod + 1] - lodFirstRanges[lod]; }
+    // the most detailed level whose error stays below maxError (in node space), the coarsest acceptable
+    int SelectLod(float maxError) const
+    {
+        int lod = 0;
+        while (lod + 1 < LodCount() && lods[lod + 1].error <= maxError)
+            lod++;
+        return lod;
+    }
+
+    // appends the buffer ranges (see BufferRange) of the meshlets that intersect the frustum and, with cullBackFacing,
+    // do not face away from eye as a whole, both given in node space. Returns how many meshlets were kept.
+    // only skip back facing meshlets when GL culls back faces too, otherwise their triangles would have been drawn.
+    unsigned int CullMeshlets(const Frustum& frustum, const glm::vec3& eye, bool cullBackFacing, vector<DrawRange>& visible) const
+    {
+        unsigned int kept = 0;
+        for (size_t i = 0; i < meshlets.size(); i++)
+        {
+            const Meshlet& meshlet = meshlets[i];
+            if (!frustum.IntersectsSphere(meshlet.center, meshlet.radius))
+                continue;
+            // every direction from eye into the sphere is within 90 degrees minus the cone's half angle of the axis,
+            // so it hits every triangle from behind
+            if (cullBackFacing)
+            {
+                glm::vec3 toCenter = meshlet.center - eye;
+                float distance = glm::length(toCenter);
+                if (glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * (distance + meshlet.radius) + meshlet.radius)
+                    continue;
+            }
+            kept++;
+            for (unsigned int j = meshletFirstRanges[i]; j < meshletFirstRanges[i + 1]; j++)
+                visible.push_back(BufferRange(meshletRanges[j]));
+        }
+        return kept;
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // the VAO to draw with, the arena's when the mesh lives in one
+    unsigned int VertexArray() const { return arena ? arena->VertexArray() : VAO; }
+    // index type of the buffer the mesh is drawn from, an arena may have widened the mesh's own indexType
+    GLenum BufferIndexType() const { return arena ? arena->IndexType() : indexType; }
+    // a range of this mesh as it sits in the buffers VertexArray() draws from
+    DrawRange BufferRange(const DrawRange& range) const
+    {
+        if (!arena)
+            return range;
+        const GeometryArena::Slot& slot = arena->GetSlot(arenaSlot);
+        DrawRange buffer = { slot.firstIndex + range.firstIndex, range.indexCount, slot.baseVertex + range.baseVertex };
+        return buffer;
+    }
+
+    // size of the vertex data on the GPU
+    size_t VertexBytes() const { return vertexCount * VertexStride(vertexFormat); }
+    // size of the index data on the GPU
+    size_t IndexBytes() const { return indexCount * IndexSize(BufferIndexType()); }
+    // system memory still held by the geometry
+    size_t ResidentBytes() const
+    {
+        return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int) + positions.capacity() * sizeof(glm::vec3);
+    }
+
+    // nearest hit of a model space ray with the triangles within maxDistance, read from whatever CPU copy
+    // ReleaseGeometry left. false if nothing is hit or the geometry was discarded.
+    bool Intersect(const Ray& ray, float maxDistance, float& distance) const
+    {
+        bool positionsOnly = vertices.empty();
+        if (indices.empty() || (positionsOnly && positions.empty()))
+            return false;
+        bool hit = false;
+        // against the full mesh, level 0
+        for (size_t i = 0; i + 2 < lods[0].indexCount; i += 3)
+        {
+            const glm::vec3& a = positionsOnly ? positions[indices[i]] : vertices[indices[i]].Position;
+            const glm::vec3& b = positionsOnly ? positions[indices[i + 1]] : vertices[indices[i + 1]].Position;
+            const glm::vec3& c = positionsOnly ? positions[indices[i + 2]] : vertices[indices[i + 2]].Position;
+            float t;
+            if (IntersectRayTriangle(ray, a, b, c, t) && t < maxDistance)
+            {
+                maxDistance = t;
+                hit = true;
+            }
+        }
+        if (hit)
+            distance = maxDistance;
+        return hit;
+    }
+
+    // drops the CPU copy of the uploaded geometry according to the policy, the mesh keeps drawing from its buffers
+    void ReleaseGeometry(GeometryRetention retention)
+    {
+        if (retention == GEOMETRY_KEEP)
+            return;
+        if (retention == GEOMETRY_POSITIONS_ONLY)
+        {
+            positions.resize(vertices.size());
+            for (size_t i = 0; i < vertices.size(); i++)
+                positions[i] = vertices[i].Position;
+        }
+        else
+        {
+            vector<glm::vec3>().swap(positions);
+            vector<unsigned int>().swap(indices);
+        }
+        // swap with an empty vector, clear() alone would keep the allocation
+        vector<Vertex>().swap(vertices);
     }
 
 private:
     //  render data
-    unsigned int VAO, VBO, EBO;
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    bool split16BitRanges;
+    // first entry in ranges of each level of detail, plus the end of the last
+    vector<unsigned int> lodFirstRanges;
+    // each meshlet cut to the level 0 ranges it lies in (usually one), meshlet i's start at meshletFirstRanges[i]
+    vector<DrawRange> meshletRanges;
+    vector<unsigned int> meshletFirstRanges;
+    // not owned, the mesh's data lives in this arena's buffers at arenaSlot
+    GeometryArena* arena = nullptr;
+    unsigned int arenaSlot = 0;
+
+    void deleteBuffers()
+    {
+        if (VAO != 0)
+        {
+            GLState::Get().ForgetVertexArray(VAO);
+            glDeleteVertexArrays(1, &VAO);
+        }
+        if (VBO != 0)
+            glDeleteBuffers(1, &VBO);
+        if (EBO != 0)
+            glDeleteBuffers(1, &EBO);
+        VAO = VBO = EBO = 0;
+    }
+
+    // a meshlet may straddle two 16 bit ranges, it then gets a piece in each with that range's base vertex
+    void buildMeshletRanges()
+    {
+        meshletRanges.clear();
+        meshletFirstRanges.clear();
+        for (const Meshlet& meshlet : meshlets)
+        {
+            meshletFirstRanges.push_back(static_cast<unsigned int>(meshletRanges.size()));
+            for (size_t i = LodFirstRange(0); i < LodFirstRange(0) + LodRangeCount(0); i++)
+            {
+                unsigned int first = max(meshlet.firstIndex, ranges[i].firstIndex);
+                unsigned int end = min(meshlet.firstIndex + meshlet.indexCount, ranges[i].firstIndex + ranges[i].indexCount);
+                if (first < end)
+                {
+                    DrawRange piece = { first, end - first, ranges[i].baseVertex };
+                    meshletRanges.push_back(piece);
+                }
+            }
+        }
+        meshletFirstRanges.push_back(static_cast<unsigned int>(meshletRanges.size()));
+    }
 
     void setupMesh()
     {
+        if (arena)
+        {
+            vector<unsigned char> vertexData = PackVertices(vertices, vertexFormat);
+            vector<unsigned char> indexData = BuildLodIndexBuffer(indices, lods, vertices.size(), split16BitRanges, indexType, ranges, lodFirstRanges);
+            buildMeshletRanges();
+            arenaSlot = arena->Append(vertexData, move(indexData), indexType);
+            return;
+        }
+
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
+        GLState::Get().BindVertexArray(VAO);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        vector<unsigned char> vertexData = PackVertices(vertices, vertexFormat);
+        glBufferData(GL_ARRAY_BUFFER, vertexData.size(), vertexData.data(), GL_STATIC_DRAW);
 
+        vector<unsigned char> indexData = BuildLodIndexBuffer(indices, lods, vertices.size(), split16BitRanges, indexType, ranges, lodFirstRanges);
+        buildMeshletRanges();
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-            &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), indexData.data(), GL_STATIC_DRAW);
 
-        // vertex positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        SetupVertexAttributes(vertexFormat);
 
-        glBindVertexArray(0);
+        GLState::Get().BindVertexArray(0);
     }
 };
 #endif
@@ -10,92 +10,604 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "AllocationCounter.h"
 #include "mesh.h"
+#include "MeshCache.h"
+#include "MeshletBuilder.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MultiDraw.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
 #include "Shader.h"
-#include <stb_image.h>
+#include "TextureCache.h"
+#include "TextureLoader.h" // pulls in stb_image.h, with the implementation requested above
+#include "ThreadPool.h"
 
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
 unsigned int TextureFromFile(const char* path, const string& directory, bool gamma = false);
 
+// post-processing applied to every imported model, part of the mesh cache key.
+// OBJ faces come in with vertices of their own: JoinIdenticalVertices welds them so triangles share vertices, which
+// the vertex cache optimization relies on. This is the one place geometry is welded, see IdenticalVertexRemap.
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals | aiProcess_FlipUVs |
+                                        aiProcess_CalcTangentSpace;
+
+// how a model is imported and uploaded, the defaults reproduce the plain LearnOpenGL behaviour
+struct ModelOptions {
+    // GPU vertex layout of every mesh
+    VertexFormat vertexFormat = VERTEX_FORMAT_FULL;
+    // reorder indices and vertices for the post-transform cache, overdraw and vertex fetch at import
+    bool optimizeMeshes = false;
+    // meshes with more than 65536 vertices are drawn as several 16 bit index ranges instead of with 32 bit indices
+    bool split16BitRanges = false;
+    // what every mesh keeps in system memory after the upload (and after the mesh cache was written)
+    GeometryRetention retention = GEOMETRY_KEEP;
+    // all meshes share one vertex buffer, one index buffer and one VAO instead of having their own
+    bool sharedArena = false;
+    // meshes with the same textures are drawn with one multi-draw call per texture set (implies sharedArena)
+    bool batchDraws = false;
+    // levels of detail generated per mesh at import, the full mesh included (1 to MAX_MESH_LODS)
+    int lodCount = 1;
+    // split the full mesh into meshlets at import and draw only those inside the frustum, and while GL_CULL_FACE is
+    // on only those not facing away (see RenderQueue::SubmitMeshlets); instanced draws keep drawing whole meshes.
+    bool meshlets = false;
+};
+
+// bits of ModelOptions that change the imported data, they are part of the mesh cache key
+const uint32_t MODEL_CACHE_OPTIMIZED = 1 << 0;
+const uint32_t MODEL_CACHE_MESHLETS = 1 << 1;
+// the level of detail count takes the bits from here on
+const int MODEL_CACHE_LOD_SHIFT = 4;
+
+// CPU side result of converting one aiMesh. Building it involves no GL calls, so it can happen on any thread;
+// only the texture ids and the buffer upload are resolved later on the thread that owns the context.
+struct MeshData {
+    vector<Vertex>       vertices;
+    vector<unsigned int> indices;
+    vector<Texture>      textures; // only type and path are filled in
+    Bounds               bounds = EmptyBounds();
+    // scene graph node the mesh was found at
+    uint32_t             node = 0;
+    // levels of detail in indices, empty for the full mesh only
+    vector<MeshLod>      lods;
+    // clusters of level 0, empty unless ModelOptions::meshlets
+    vector<Meshlet>      meshlets;
+    // vertex cache efficiency before and after OptimizeMesh, if it ran
+    VertexCacheStatistics cacheBefore, cacheAfter;
+};
+
 class Model
 {
 public:
     // model data 
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    vector<Texture> textures_loaded;	// every distinct texture this model holds a reference to in the TextureCache.
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    ModelOptions options;
+    // the node hierarchy of the file, every mesh hangs off one of its nodes
+    SceneGraph sceneGraph;
+    // model space bounds around all meshes, placed by their nodes
+    Bounds bounds = EmptyBounds();
+    // over the model space bounds of every mesh (primitive i is meshes[i]), for culling and picking. Refitted by
+    // UpdateTransforms() when nodes moved.
+    BVH meshBVH;
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const& path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const& path, bool gamma = false, ModelOptions options = ModelOptions()) : gammaCorrection(gamma), options(options)
     {
         loadModel(path);
     }
 
-    // draws the model, and thus all its meshes
-    void Draw(Shader& shader)
+    // the model owns references to shared textures, copying it would release them twice
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+
+    ~Model()
+    {
+        for (const Texture& texture : textures_loaded)
+            TextureCache::Shared().Release(texture.id);
+    }
+
+    // draws the model right away, every mesh placed by model and its node's world transform, at full detail and
+    // without culling. The shader takes the matrix from the Transforms block like queued draws, so the draws go through
+    // a queue and ring of the model's own, created on first use and fenced per call. Fine for a few calls per frame,
+    // scenes should Submit() everything to one queue instead.
+    void Draw(Shader& shader, const glm::mat4& model = glm::mat4(1.0f))
     {
-        for (unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        if (!drawQueue)
+        {
+            // a transform per mesh at the largest common uniform offset alignment, nothing else goes into the ring
+            drawRing.reset(new RingBuffer((meshes.size() + 1) * 256));
+            drawQueue.reset(new RenderQueue(*drawRing));
+        }
+        drawRing->BeginFrame();
+        drawQueue->Begin(glm::vec3(0.0f), 0.0f);
+        submit(*drawQueue, RENDER_PASS_OPAQUE, shader, model, nullptr, 0, false);
+        drawQueue->Sort();
+        drawRing->Flush();
+        drawQueue->Execute(RENDER_PASS_OPAQUE);
+        drawRing->EndFrame();
+    }
+
+    // the levels of detail of the mesh with the most of them
+    int LodCount() const { return lodLevels; }
+
+    // the coarsest level of detail of the whole model whose error stays within LOD_MAX_PIXEL_ERROR on screen at
+    // transform, for SubmitInstanced()
+    int SelectLod(const RenderQueue& queue, const glm::mat4& transform) const
+    {
+        float maxError = queue.MaxLodError(TransformBounds(bounds, transform)) / MaxScale(transform);
+        int lod = 0;
+        while (lod + 1 < lodLevels && lodErrors[lod + 1] <= maxError)
+            lod++;
+        return lod;
+    }
+
+    // applies node transforms changed through sceneGraph since the last call, call once per frame before submitting
+    void UpdateTransforms()
+    {
+        if (sceneGraph.Update() > 0)
+            updateBounds(true);
+    }
+
+    // nearest hit of a world space ray with the model placed by transform, mesh receives which mesh was hit.
+    // tests triangles, so it needs geometry kept by options.retention (anything but GEOMETRY_DISCARD).
+    bool Intersect(const glm::mat4& transform, const Ray& ray, float maxDistance, float& distance, size_t& mesh) const
+    {
+        // meshBVH finds the meshes whose boxes the model space ray enters, nearest first, and the node space ray keeps
+        // world space distances (see Ray) for the triangle test
+        Ray modelRay = TransformRay(ray, glm::inverse(transform));
+        RayHit hit;
+        bool found = meshBVH.Raycast(modelRay, maxDistance, hit, [this](uint32_t primitive, const Ray& bvhRay, float nearest, float& hitDistance)
+        {
+            Ray localRay = TransformRay(bvhRay, glm::inverse(sceneGraph.World(meshes[primitive].node)));
+            return meshes[primitive].Intersect(localRay, nearest, hitDistance);
+        });
+        if (found)
+        {
+            distance = hit.distance;
+            mesh = hit.primitive;
+        }
+        return found;
+    }
+
+    // records the model's draws in the queue instead of drawing right away, the queue orders them by state.
+    // meshes outside the queue's frustum are left out, the others drawn at the level of detail their size on screen needs.
+    void Submit(RenderQueue& queue, RenderPass pass, Shader& shader, const glm::mat4& model)
+    {
+        submit(queue, pass, shader, model, nullptr, 0, true);
+    }
+
+    // records one instanced draw per mesh (or batch) placing a copy of the model at every transform in the buffer.
+    // the shader takes the model matrix from the instance attributes, see instanced.vs. Nothing is culled here,
+    // cull the transforms against Model::bounds before they go into the buffer (RenderQueue::CullInstances), and
+    // group them by SelectLod() to draw each group at its level of detail.
+    void SubmitInstanced(RenderQueue& queue, RenderPass pass, Shader& shader, const InstanceBuffer& instances, int lod = 0)
+    {
+        if (instances.Count() > 0)
+            submit(queue, pass, shader, glm::mat4(1.0f), &instances, min(max(lod, 0), lodLevels - 1), false);
     }
 
 private:
     // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    // the converted meshes are cached next to the model file (<path>.meshcache) so later runs can skip ASSIMP entirely.
     void loadModel(string const& path)
     {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        size_t allocationsBefore = AllocationCount();
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+        if (options.sharedArena || options.batchDraws)
+            arena.reset(new GeometryArena(options.vertexFormat));
+
+        // a changed source file, material library or different import flags invalidate the cache
+        string cachePath = path + ".meshcache";
+        uint64_t sourceHash = 0;
+        bool cacheable = HashModelSources(path, sourceHash);
+        uint32_t cacheOptions = cacheOptionFlags();
+        if (cacheable && loadFromCache(cachePath, sourceHash, cacheOptions))
+        {
+            finishMeshes();
+            cout << "Model: loaded " << path << " from mesh cache in " << elapsedMs(start) << " ms (warm start"
+                 << AllocationSummary(allocationsBefore) << ")" << endl;
+            releaseGeometry();
+            printStatistics();
+            return;
+        }
+
         // read file via ASSIMP
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
         // check for errors
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
             return;
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        // process ASSIMP's root node recursively, collecting the meshes in traversal order and the nodes into the scene graph
+        vector<const aiMesh*> sceneMeshes;
+        vector<uint32_t> meshNodes;
+        sceneGraph.Clear();
+        processNode(scene->mRootNode, scene, SCENE_NO_PARENT, sceneMeshes, meshNodes);
+
+        // convert (and optimize) all meshes in parallel, they are independent of each other
+        vector<MeshData> meshData(sceneMeshes.size());
+        ThreadPool::Shared().ParallelFor(sceneMeshes.size(), [&](size_t i)
+        {
+            meshData[i] = processMesh(sceneMeshes[i], scene);
+            meshData[i].node = meshNodes[i];
+            if (options.optimizeMeshes)
+                OptimizeMesh(meshData[i].vertices, meshData[i].indices, meshData[i].cacheBefore, meshData[i].cacheAfter);
+            const vector<Vertex>& vertices = meshData[i].vertices;
+            meshData[i].bounds = ComputeBounds(vertices.empty() ? nullptr : &vertices[0].Position, vertices.size(), sizeof(Vertex));
+            if (options.lodCount > 1)
+                GenerateLods(vertices, meshData[i].indices, min(options.lodCount, MAX_MESH_LODS), options.optimizeMeshes, meshData[i].lods);
+            if (options.meshlets)
+                BuildMeshlets(vertices, meshData[i].indices, meshData[i].lods.empty() ? meshData[i].indices.size() : meshData[i].lods[0].indexCount,
+                              meshData[i].meshlets);
+        });
+        if (options.optimizeMeshes)
+            printOptimizationStatistics(meshData);
+
+        // texture loading and buffer uploads need the GL context, so they stay on this thread
+        meshes.reserve(meshData.size());
+        for (MeshData& data : meshData)
+            createMesh(move(data));
+        finishMeshes();
+
+        bool cacheWritten = cacheable && WriteMeshCache(cachePath, sourceHash, MODEL_IMPORT_FLAGS, cacheOptions, meshes, sceneGraph);
+        cout << "Model: imported " << path << " with ASSIMP in " << elapsedMs(start) << " ms (cold start"
+             << AllocationSummary(allocationsBefore)
+             << (cacheWritten ? ", mesh cache written)" : ", mesh cache NOT written)") << endl;
+        releaseGeometry();
+        printStatistics();
+    }
+
+    // each mesh is drawn with model * its node's transform. Instances were culled as a whole, so with instances every
+    // mesh is drawn at instanceLod; otherwise meshBVH drops the meshes outside the frustum and each of the others gets
+    // the level of detail its own size on screen needs. With useMeshlets, a mesh at full detail with meshlets has
+    // those culled one by one, which needs the queue's eye and frustum.
+    void submit(RenderQueue& queue, RenderPass pass, Shader& shader, const glm::mat4& model, const InstanceBuffer* instances, int instanceLod,
+                bool useMeshlets)
+    {
+        meshVisible.assign(meshes.size(), instances ? 1 : 0);
+        if (!instances)
+        {
+            queue.CullPrimitives(meshBVH, model, visibleMeshes, pass);
+            for (uint32_t mesh : visibleMeshes)
+                meshVisible[mesh] = 1;
+        }
+        if (batches.empty())
+        {
+            for (size_t i = 0; i < meshes.size(); i++)
+            {
+                glm::mat4 transform = model * sceneGraph.World(meshes[i].node);
+                Bounds world = TransformBounds(meshes[i].bounds, transform);
+                if (!meshVisible[i])
+                    continue;
+                int lod = instances ? min(instanceLod, meshes[i].LodCount() - 1) : meshes[i].SelectLod(queue.MaxLodError(world) / MaxScale(transform));
+                if (useMeshlets && lod == 0 && !meshes[i].meshlets.empty())
+                    queue.SubmitMeshlets(pass, shader, meshes[i], meshTextureSets[i], transform, world.center);
+                else
+                    queue.SubmitMesh(pass, shader, meshes[i], meshTextureSets[i], transform, world.center, instances, lod);
+            }
+            return;
+        }
+
+        // a run of consecutive visible meshes on the same node and level stays a single multi-draw. The draw list
+        // holds every batch once per model level, with each mesh at that level or its coarsest below it.
+        for (const DrawBatch& batch : batches)
+        {
+            size_t runFirst = 0, runCount = 0;
+            uint32_t runNode = 0;
+            int runLevel = 0;
+            Bounds runBounds = EmptyBounds();
+            auto submitRun = [&]()
+            {
+                if (runCount > 0)
+                    queue.SubmitMultiDraw(pass, shader, batch.textures, batch.samplers, batch.textureSet, arena->VertexArray(), drawList,
+                                          runFirst, runCount, model * sceneGraph.World(runNode), runBounds.center, instances);
+                runCount = 0;
+                runBounds = EmptyBounds();
+            };
+            for (size_t meshIndex : batch.meshes)
+            {
+                const Mesh& mesh = meshes[meshIndex];
+                glm::mat4 transform = model * sceneGraph.World(mesh.node);
+                Bounds world = TransformBounds(mesh.bounds, transform);
+                if (!meshVisible[meshIndex])
+                {
+                    submitRun();
+                    continue;
+                }
+                int level = instances ? instanceLod : mesh.SelectLod(queue.MaxLodError(world) / MaxScale(transform));
+                if (useMeshlets && level == 0 && !mesh.meshlets.empty())
+                {
+                    submitRun();
+                    queue.SubmitMeshlets(pass, shader, mesh, batch.textureSet, transform, world.center);
+                    continue;
+                }
+                if (runCount > 0 && (mesh.node != runNode || level != runLevel))
+                    submitRun();
+                if (runCount == 0)
+                {
+                    runFirst = meshFirstCommands[level][meshIndex];
+                    runNode = mesh.node;
+                    runLevel = level;
+                }
+                runCount += mesh.LodRangeCount(min(level, mesh.LodCount() - 1));
+                runBounds = MergeBounds(runBounds, world);
+            }
+            submitRun();
+        }
+    }
+
+    // once every mesh is created: uploads the shared arena, groups the draws and numbers the texture sets
+    void finishMeshes()
+    {
+        lodLevels = 1;
+        for (const Mesh& mesh : meshes)
+            lodLevels = max(lodLevels, mesh.LodCount());
+        if (arena)
+        {
+            arena->Upload();
+            if (options.batchDraws)
+                buildBatches();
+        }
+        meshTextureSets.clear();
+        for (const Mesh& mesh : meshes)
+            meshTextureSets.push_back(TextureSetId(mesh.textures));
+        updateBounds(false);
+        // a model level's error is the largest among its meshes at that level
+        lodErrors.assign(lodLevels, 0.0f);
+        for (int level = 0; level < lodLevels; level++)
+            for (const Mesh& mesh : meshes)
+                lodErrors[level] = max(lodErrors[level], mesh.lods[min(level, mesh.LodCount() - 1)].error);
+        for (DrawBatch& batch : batches)
+            batch.textureSet = TextureSetId(batch.textures);
+    }
+
+    // the bounds of the meshes placed by their nodes' world matrices, the tree is kept and refitted if they moved
+    void updateBounds(bool refit)
+    {
+        bounds = EmptyBounds();
+        meshBounds.clear();
+        for (const Mesh& mesh : meshes)
+        {
+            meshBounds.push_back(TransformBounds(mesh.bounds, sceneGraph.World(mesh.node)));
+            bounds = MergeBounds(bounds, meshBounds.back());
+        }
+        if (refit)
+            meshBVH.Refit(meshBounds);
+        else
+            meshBVH.Build(meshBounds);
+    }
+
+    // groups the meshes by texture set and records one draw command per range, each group's commands kept together
+    void buildBatches()
+    {
+        map<vector<unsigned int>, size_t> batchByTextures;
+        for (const Mesh& mesh : meshes)
+        {
+            vector<unsigned int> key;
+            for (const Texture& texture : mesh.textures)
+                key.push_back(texture.id);
+            map<vector<unsigned int>, size_t>::iterator found = batchByTextures.find(key);
+            if (found == batchByTextures.end())
+            {
+                found = batchByTextures.emplace(key, batches.size()).first;
+                DrawBatch batch;
+                batch.textures = mesh.textures;
+                batch.samplers = mesh.samplers;
+                batches.push_back(batch);
+            }
+            batches[found->second].meshes.push_back(static_cast<size_t>(&mesh - meshes.data()));
+        }
+
+        // meshes on the same node next to each other, they can be drawn as one run
+        for (DrawBatch& batch : batches)
+            stable_sort(batch.meshes.begin(), batch.meshes.end(), [this](size_t a, size_t b) { return meshes[a].node < meshes[b].node; });
+        for (int level = 0; level < lodLevels; level++)
+        {
+            meshFirstCommands[level].assign(meshes.size(), 0);
+            for (DrawBatch& batch : batches)
+            {
+                batch.firstCommand[level] = drawList.Size();
+                for (size_t meshIndex : batch.meshes)
+                {
+                    const Mesh& mesh = meshes[meshIndex];
+                    int lod = min(level, mesh.LodCount() - 1);
+                    meshFirstCommands[level][meshIndex] = drawList.Size();
+                    for (size_t i = mesh.LodFirstRange(lod); i < mesh.LodFirstRange(lod) + mesh.LodRangeCount(lod); i++)
+                        drawList.Add(mesh.BufferRange(mesh.ranges[i]));
+                }
+                batch.commandCount[level] = drawList.Size() - batch.firstCommand[level];
+            }
+        }
+        drawList.Upload(arena->IndexType());
+    }
+
+    void releaseGeometry()
+    {
+        for (Mesh& mesh : meshes)
+            mesh.ReleaseGeometry(options.retention);
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode* node, const aiScene* scene)
+    void printStatistics() const
     {
-        // process each mesh located at the current node
+        size_t vertexCount = 0, vertexBytes = 0, indexBytes = 0, narrowMeshes = 0, residentBytes = 0;
+        for (const Mesh& mesh : meshes)
+        {
+            vertexCount += mesh.vertexCount;
+            residentBytes += mesh.ResidentBytes();
+            vertexBytes += mesh.VertexBytes();
+            indexBytes += mesh.IndexBytes();
+            if (mesh.BufferIndexType() == GL_UNSIGNED_SHORT)
+                narrowMeshes++;
+        }
+        cout << "Model: " << meshes.size() << " meshes, " << vertexCount << " vertices, "
+             << vertexBytes / 1024 << " KiB of vertex data (" << VertexStride(options.vertexFormat) << " bytes per vertex), "
+             << indexBytes / 1024 << " KiB of index data (" << narrowMeshes << " meshes with 16 bit indices), "
+             << residentBytes / 1024 << " KiB of geometry kept in system memory"
+             << (arena ? ", all in one shared arena" : "") << endl;
+        size_t meshletCount = 0, meshletTriangles = 0;
+        for (const Mesh& mesh : meshes)
+        {
+            meshletCount += mesh.meshlets.size();
+            for (const Meshlet& meshlet : mesh.meshlets)
+                meshletTriangles += meshlet.indexCount / 3;
+        }
+        if (meshletCount > 0)
+            cout << "Model: " << meshletCount << " meshlets of " << static_cast<float>(meshletTriangles) / meshletCount << " triangles on average" << endl;
+        if (lodLevels > 1)
+        {
+            cout << "Model: triangles per level of detail:";
+            for (int level = 0; level < lodLevels; level++)
+            {
+                size_t triangles = 0;
+                for (const Mesh& mesh : meshes)
+                    triangles += mesh.lods[min(level, mesh.LodCount() - 1)].indexCount / 3;
+                cout << " " << triangles << " (error " << lodErrors[level] << ")";
+            }
+            cout << endl;
+        }
+        if (!batches.empty())
+            cout << "Model: " << drawList.Size() << " draws submitted in " << batches.size() << " batches through "
+                 << (drawList.Indirect() ? "glMultiDrawElementsIndirect" : "glMultiDrawElementsBaseVertex") << endl;
+    }
+
+    // the options that change what ends up in the mesh cache
+    uint32_t cacheOptionFlags() const
+    {
+        uint32_t flags = 0;
+        if (options.optimizeMeshes)
+            flags |= MODEL_CACHE_OPTIMIZED;
+        if (options.meshlets)
+            flags |= MODEL_CACHE_MESHLETS;
+        if (options.lodCount > 1)
+            flags |= static_cast<uint32_t>(min(options.lodCount, MAX_MESH_LODS)) << MODEL_CACHE_LOD_SHIFT;
+        return flags;
+    }
+
+    // rebuilds the meshes from a cache file, returns false if the cache is missing or stale
+    bool loadFromCache(string const& cachePath, uint64_t sourceHash, uint32_t cacheOptions)
+    {
+        MeshCacheReader cache;
+        if (!cache.Open(cachePath, sourceHash, MODEL_IMPORT_FLAGS, cacheOptions))
+            return false;
+
+        sceneGraph.Clear();
+        for (uint32_t i = 0; i < cache.NodeCount(); i++)
+        {
+            glm::mat4 local;
+            memcpy(&local[0][0], cache.Node(i).local, sizeof(cache.Node(i).local));
+            sceneGraph.AddNode(cache.Node(i).parent, local);
+        }
+        meshes.reserve(cache.MeshCount());
+        for (uint32_t i = 0; i < cache.MeshCount(); i++)
+        {
+            const MeshCacheRecord& record = cache.Record(i);
+            const Vertex* firstVertex = cache.Vertices() + record.firstVertex;
+            const unsigned int* firstIndex = cache.Indices() + record.firstIndex;
+            MeshData data;
+            data.vertices.assign(firstVertex, firstVertex + record.vertexCount);
+            data.indices.assign(firstIndex, firstIndex + record.indexCount);
+            data.bounds = record.bounds;
+            data.node = record.node;
+            data.lods.assign(cache.Lods() + record.firstLod, cache.Lods() + record.firstLod + record.lodCount);
+            data.meshlets.assign(cache.Meshlets() + record.firstMeshlet, cache.Meshlets() + record.firstMeshlet + record.meshletCount);
+            for (uint32_t t = record.firstTexture; t < record.firstTexture + record.textureCount; t++)
+            {
+                Texture texture;
+                texture.id = 0;
+                texture.type = cache.TextureType(t);
+                texture.path = cache.TexturePath(t);
+                data.textures.push_back(texture);
+            }
+            createMesh(move(data));
+        }
+        return true;
+    }
+
+    // per mesh ACMR/ATVR of a FIFO post-transform cache, before and after optimization
+    static void printOptimizationStatistics(const vector<MeshData>& meshData)
+    {
+        size_t triangles = 0;
+        float missesBefore = 0.0f, missesAfter = 0.0f;
+        for (size_t i = 0; i < meshData.size(); i++)
+        {
+            const MeshData& data = meshData[i];
+            cout << "Model: mesh " << i << ": ACMR " << data.cacheBefore.acmr << " -> " << data.cacheAfter.acmr
+                 << ", ATVR " << data.cacheBefore.atvr << " -> " << data.cacheAfter.atvr << endl;
+            size_t meshTriangles = (data.lods.empty() ? data.indices.size() : data.lods[0].indexCount) / 3;
+            triangles += meshTriangles;
+            missesBefore += data.cacheBefore.acmr * meshTriangles;
+            missesAfter += data.cacheAfter.acmr * meshTriangles;
+        }
+        if (triangles > 0)
+            cout << "Model: overall ACMR " << missesBefore / triangles << " -> " << missesAfter / triangles << endl;
+    }
+
+    static double elapsedMs(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+
+    // processes a node in a recursive fashion. Collects each individual mesh located at the node and repeats this process on its children nodes (if any).
+    // the node itself goes into the scene graph, meshNodes receives the scene graph node of every collected mesh.
+    void processNode(aiNode* node, const aiScene* scene, uint32_t parent, vector<const aiMesh*>& sceneMeshes, vector<uint32_t>& meshNodes)
+    {
+        // assimp matrices are row major
+        const aiMatrix4x4& m = node->mTransformation;
+        glm::mat4 local(m.a1, m.b1, m.c1, m.d1, m.a2, m.b2, m.c2, m.d2, m.a3, m.b3, m.c3, m.d3, m.a4, m.b4, m.c4, m.d4);
+        uint32_t index = sceneGraph.AddNode(parent, local);
+        // collect each mesh located at the current node
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             // the node object only contains indices to index the actual objects in the scene. 
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+            meshNodes.push_back(index);
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, index, sceneMeshes, meshNodes);
         }
 
     }
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    // converts an aiMesh into our own vertex/index layout. Runs on worker threads: it only reads the scene
+    // and must not touch OpenGL or any member of the model.
+    static MeshData processMesh(const aiMesh* mesh, const aiScene* scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        MeshData data;
+        vector<Vertex>& vertices = data.vertices;
+        vector<unsigned int>& indices = data.indices;
+        vector<Texture>& textures = data.textures;
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve(mesh->mNumFaces * 3); // faces are triangles after aiProcess_Triangulate
 
         // walk through each of the mesh's vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
+            // value-initialized: attributes the mesh lacks and the bone slots stay zero rather than indeterminate,
+            // they are compared, hashed and written to the mesh cache
+            Vertex vertex{};
             glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // positions
             vector.x = mesh->mVertices[i].x;
@@ -138,7 +650,7 @@ private:
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace& face = mesh->mFaces[i];
             // retrieve all indices of the face and store them in the indices vector
             for (unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);
@@ -153,94 +665,107 @@ private:
         // normal: texture_normalN
 
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        collectMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        collectMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        collectMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
         // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+        collectMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", textures);
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
+    // appends a reference to every material texture of a given type, the textures themselves are loaded by createMesh.
+    static void collectMaterialTextures(const aiMaterial* mat, aiTextureType type, string typeName, vector<Texture>& textures)
     {
-        vector<Texture> textures;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for (unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if (!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
         }
-        return textures;
     }
-};
 
+    // resolves the texture references and uploads the converted mesh into meshes, must run on the GL thread.
+    // the geometry is moved all the way into the Mesh, it is never copied.
+    void createMesh(MeshData&& data)
+    {
+        vector<Texture> textures;
+        textures.reserve(data.textures.size());
+        for (const Texture& ref : data.textures)
+            textures.push_back(loadTexture(ref.path, ref.type));
+        // construct the mesh in place from the extracted mesh data
+        meshes.emplace_back(move(data.vertices), move(data.indices), move(textures), options.vertexFormat, options.split16BitRanges, arena.get(),
+                            move(data.lods), move(data.meshlets));
+        meshes.back().bounds = data.bounds;
+        meshes.back().node = data.node;
+    }
 
-unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
-{
-    string filename = string(path);
-    filename = directory + '/' + filename;
+    // returns the texture at the given path (relative to the model directory). Each distinct path is acquired from the
+    // process-wide TextureCache once per model, so textures shared with other models are only loaded once as well.
+    Texture loadTexture(string const& path, string const& typeName)
+    {
+        // check if texture was loaded before and if so, skip loading a new texture
+        unordered_map<string, size_t>::iterator loaded = texturesByPath.find(path);
+        if (loaded != texturesByPath.end())
+            return textures_loaded[loaded->second]; // a texture with the same filepath has already been loaded (optimization)
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+        Texture texture;
+        texture.id = TextureCache::Shared().Acquire(this->directory + '/' + path, gammaCorrection);
+        texture.type = typeName;
+        texture.path = path;
+        texturesByPath.emplace(path, textures_loaded.size());
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+        return texture;
+    }
 
-    int width, height, nrComponents;
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
+    // index into textures_loaded by the path as written in the material
+    unordered_map<string, size_t> texturesByPath;
+    // buffers shared by all meshes when options.sharedArena is set
+    unique_ptr<GeometryArena> arena;
+    // what meshBVH was built from, by mesh
+    vector<Bounds> meshBounds;
+    // submit()'s scratch: which meshes meshBVH found in the frustum
+    vector<uint32_t> visibleMeshes;
+    vector<uint8_t> meshVisible;
+    // what Draw() goes through, created on its first call
+    unique_ptr<RingBuffer> drawRing;
+    unique_ptr<RenderQueue> drawQueue;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    // meshes drawn together because they bind the same textures
+    struct DrawBatch {
+        vector<Texture> textures;
+        vector<string> samplers;
+        uint32_t textureSet;
+        // the batch's commands at each model level of detail
+        size_t firstCommand[MAX_MESH_LODS];
+        size_t commandCount[MAX_MESH_LODS];
+        vector<size_t> meshes; // in command order
+    };
+    vector<DrawBatch> batches;
+    MultiDrawList drawList;
+    // first command of each mesh in drawList per model level, a mesh's commands are consecutive
+    vector<size_t> meshFirstCommands[MAX_MESH_LODS];
+    // levels of detail of the model: the most any mesh has, and the largest mesh error at each
+    int lodLevels = 1;
+    vector<float> lodErrors;
+    // TextureSetId of every mesh, for the render queue's sort key
+    vector<uint32_t> meshTextureSets;
+};
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
+// returns a texture id right away; the image itself is decoded in the background and
+// shows up once TextureLoader::Pump() has uploaded it on the GL thread.
+unsigned int TextureFromFile(const char* path, const string& directory, bool gamma)
+{
+    string filename = string(path);
+    filename = directory + '/' + filename;
 
-    return textureID;
+    return TextureLoader::Shared().Load(filename, gamma);
 }
 #endif
\ No newline at end of file
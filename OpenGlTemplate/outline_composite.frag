@@ -0,0 +1,38 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D sceneColor;
+uniform sampler2D outlineMask;
+uniform vec4 outlineColor;
+uniform int outlineWidth;
+
+// copies the scene and paints every pixel outside the mask that lies within outlineWidth pixels of it
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 scene = texelFetch(sceneColor, pixel, 0);
+    if (texelFetch(outlineMask, pixel, 0).r > 0.5)
+    {
+        FragColor = scene;
+        return;
+    }
+
+    ivec2 size = textureSize(outlineMask, 0);
+    for (int y = -outlineWidth; y <= outlineWidth; y++)
+    {
+        for (int x = -outlineWidth; x <= outlineWidth; x++)
+        {
+            if (x * x + y * y > outlineWidth * outlineWidth)
+                continue;
+            ivec2 neighbour = clamp(pixel + ivec2(x, y), ivec2(0), size - 1);
+            if (texelFetch(outlineMask, neighbour, 0).r > 0.5)
+            {
+                FragColor = outlineColor;
+                return;
+            }
+        }
+    }
+    FragColor = scene;
+}
\ No newline at end of file
@@ -0,0 +1,8 @@
+#version 330 core
+out vec4 FragColor;
+
+// only runs where the stencil test lets it through, i.e. on the pixels the model covers
+void main()
+{
+    FragColor = vec4(1.0);
+}
\ No newline at end of file